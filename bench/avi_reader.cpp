@@ -0,0 +1,99 @@
+#include "avi_reader.h"
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+
+namespace lpvc::bench
+{
+
+
+static std::string readFourCC(const std::vector<std::byte>& data, std::size_t offset)
+{
+  return std::string(reinterpret_cast<const char*>(data.data() + offset), 4);
+}
+
+
+static std::uint32_t readUInt32(const std::vector<std::byte>& data, std::size_t offset)
+{
+  std::uint32_t value;
+  std::memcpy(&value, data.data() + offset, sizeof(value));
+
+  return value;
+}
+
+
+AviReader::AviReader(const std::string& path)
+{
+  std::ifstream file(path, std::ios::binary);
+
+  if(!file)
+    throw std::runtime_error("Failed to open " + path + ".");
+
+  std::vector<char> fileData((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::vector<std::byte> data(fileData.size());
+  std::memcpy(data.data(), fileData.data(), fileData.size());
+
+  if(data.size() < 12 || readFourCC(data, 0) != "RIFF" || readFourCC(data, 8) != "AVI ")
+    throw std::runtime_error(path + " is not an AVI file.");
+
+  readChunks(data, 0, data.size());
+
+  if(bitmapInfo_.width == 0 || bitmapInfo_.height == 0)
+    throw std::runtime_error(path + " has no main AVI header.");
+}
+
+
+const BitmapInfo& AviReader::bitmapInfo() const noexcept
+{
+  return bitmapInfo_;
+}
+
+
+std::size_t AviReader::frameCount() const noexcept
+{
+  return frames_.size();
+}
+
+
+const std::vector<std::byte>& AviReader::frame(std::size_t frameIndex) const
+{
+  return frames_.at(frameIndex);
+}
+
+
+void AviReader::readChunks(const std::vector<std::byte>& data, std::size_t begin, std::size_t end)
+{
+  while(begin + 8 <= end)
+  {
+    auto id = readFourCC(data, begin);
+    auto size = readUInt32(data, begin + 4);
+    auto dataOffset = begin + 8;
+
+    if(size > end - dataOffset)
+      throw std::runtime_error("Truncated AVI chunk.");
+
+    // Lists hold a 4 byte list type followed by subchunks.
+    if(id == "RIFF" || id == "LIST")
+    {
+      readChunks(data, dataOffset + 4, dataOffset + size);
+    }
+    else if(id == "avih" && size >= 40)
+    {
+      bitmapInfo_.width = readUInt32(data, dataOffset + 32);
+      bitmapInfo_.height = readUInt32(data, dataOffset + 36);
+    }
+    else if(id.compare(2, 2, "dc") == 0 || id.compare(2, 2, "db") == 0)
+    {
+      frames_.emplace_back(data.begin() + dataOffset, data.begin() + dataOffset + size);
+    }
+
+    // Chunks are padded to even size.
+    begin = dataOffset + size + (size & 1);
+  }
+}
+
+
+} // namespace lpvc::bench
@@ -0,0 +1,42 @@
+#ifndef LIBLPVC_BENCH_AVI_READER_H
+#define LIBLPVC_BENCH_AVI_READER_H
+
+#include <lpvc/lpvc.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+namespace lpvc::bench
+{
+
+
+// ===========================================================================
+//  AviReader
+// ===========================================================================
+
+// Minimal RIFF/AVI reader, just enough to pull LPVC frames out of the sample
+// videos. Only the main header and video chunks ("##dc" / "##db") are read,
+// index and stream headers are ignored.
+
+class AviReader final
+{
+public:
+  explicit AviReader(const std::string& path);
+
+  const BitmapInfo& bitmapInfo() const noexcept;
+  std::size_t frameCount() const noexcept;
+  const std::vector<std::byte>& frame(std::size_t frameIndex) const;
+
+private:
+  void readChunks(const std::vector<std::byte>& data, std::size_t begin, std::size_t end);
+
+  BitmapInfo bitmapInfo_;
+  std::vector<std::vector<std::byte>> frames_;
+};
+
+
+} // namespace lpvc::bench
+
+
+#endif // LIBLPVC_BENCH_AVI_READER_H
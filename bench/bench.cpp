@@ -0,0 +1,325 @@
+// Per stage benchmarks over LPVC encoded AVI files (the bundled samples by
+// default). Frames are decoded up front, every stage then runs over the
+// same raw bitmaps. Throughput is given in frames per second and in MB of
+// uncompressed data per second, ratio is uncompressed to compressed size.
+//
+// Usage: liblpvc-bench [--frames N] [--levels L1,L2,...] [file.avi ...]
+
+#include "avi_reader.h"
+#include <lpvc/lpvc.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace lpvc::bench
+{
+
+
+using Clock = std::chrono::steady_clock;
+
+
+struct IndexedFrame
+{
+  Palette palette;
+  std::vector<std::uint8_t> indices;
+  std::vector<std::byte> packedIndices;
+};
+
+
+// Runs function repeatedly for at least minDuration, returns time per run.
+template<typename Function>
+static double measure(Function&& function)
+{
+  constexpr auto minDuration = std::chrono::milliseconds(200);
+
+  std::size_t runCount = 0;
+  auto start = Clock::now();
+  auto end = start;
+
+  do
+  {
+    function();
+    ++runCount;
+    end = Clock::now();
+  }
+  while(end - start < minDuration);
+
+  return std::chrono::duration<double>(end - start).count() / runCount;
+}
+
+
+static void report(const char* stage, int level, std::size_t frameCount, std::size_t uncompressedSize, std::size_t compressedSize, double seconds)
+{
+  auto levelText = (level != 0) ? std::to_string(level) : std::string("-");
+  char ratioText[32] = "-";
+
+  if(compressedSize != 0)
+    std::snprintf(ratioText, sizeof(ratioText), "%.2f", static_cast<double>(uncompressedSize) / compressedSize);
+
+  std::printf("  %-10s %5s %12.1f %12.1f %10s\n",
+              stage,
+              levelText.c_str(),
+              frameCount / seconds,
+              uncompressedSize / seconds / (1024.0 * 1024.0),
+              ratioText);
+}
+
+
+static std::vector<IndexedFrame> makeIndexedFrames(const BitmapInfo& bitmapInfo, const std::vector<std::vector<Color>>& bitmaps)
+{
+  Encoder encoder(bitmapInfo);
+  ColorMap colorMap;
+  std::vector<IndexedFrame> indexedFrames;
+
+  for(const auto& bitmap : bitmaps)
+  {
+    auto palette = encoder.analyzePalette(bitmap.data());
+
+    if(!palette)
+      continue;
+
+    auto& indexedFrame = indexedFrames.emplace_back();
+    indexedFrame.palette = *palette;
+    indexedFrame.indices.resize(bitmap.size());
+    indexedFrame.packedIndices.resize(packedIndicesSize(palette->bits(), bitmap.size()));
+
+    colorMap.clear();
+
+    for(std::size_t colorIdx = 0; colorIdx != palette->size(); ++colorIdx)
+      colorMap.insert(packColor((*palette)[colorIdx]), static_cast<unsigned char>(colorIdx));
+
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmap.size(); ++pixelIdx)
+      indexedFrame.indices[pixelIdx] = *colorMap.find(packColor(bitmap[pixelIdx]));
+
+    packIndices(palette->bits(), indexedFrame.indices.data(), bitmap.size(), indexedFrame.packedIndices.data());
+  }
+
+  return indexedFrames;
+}
+
+
+static void benchmarkFile(const std::string& path, std::size_t maxFrameCount, const std::vector<int>& levels)
+{
+  AviReader aviReader(path);
+
+  const auto& bitmapInfo = aviReader.bitmapInfo();
+  const auto pixelCount = bitmapInfo.width * bitmapInfo.height;
+  const auto frameCount = std::min(maxFrameCount, aviReader.frameCount());
+  const auto bitmapsSize = frameCount * pixelCount * sizeof(Color);
+
+  std::vector<std::vector<Color>> bitmaps;
+  Decoder sourceDecoder(bitmapInfo);
+
+  for(std::size_t frameIdx = 0; frameIdx != frameCount; ++frameIdx)
+  {
+    const auto& frame = aviReader.frame(frameIdx);
+    sourceDecoder.decode(frame.data(), frame.size(), bitmaps.emplace_back(pixelCount).begin());
+  }
+
+  auto indexedFrames = makeIndexedFrames(bitmapInfo, bitmaps);
+
+  std::size_t indicesSize = 0;
+  std::size_t packedIndicesSize = 0;
+
+  for(const auto& indexedFrame : indexedFrames)
+  {
+    indicesSize += indexedFrame.indices.size();
+    packedIndicesSize += indexedFrame.packedIndices.size();
+  }
+
+  std::printf("%s (%zux%zu, %zu frames, %zu indexed)\n", path.c_str(), bitmapInfo.width, bitmapInfo.height, frameCount, indexedFrames.size());
+  std::printf("  %-10s %5s %12s %12s %10s\n", "stage", "level", "frames/s", "MB/s", "ratio");
+
+  {
+    Encoder encoder(bitmapInfo);
+
+    auto seconds = measure([&]()
+    {
+      for(const auto& bitmap : bitmaps)
+        encoder.analyzePalette(bitmap.data());
+    });
+
+    report("palette", 0, frameCount, bitmapsSize, 0, seconds);
+  }
+
+  if(!indexedFrames.empty())
+  {
+    std::vector<std::byte> packedIndices(pixelCount);
+    std::vector<Color> bitmap(pixelCount);
+
+    auto packSeconds = measure([&]()
+    {
+      for(const auto& indexedFrame : indexedFrames)
+        packIndices(indexedFrame.palette.bits(), indexedFrame.indices.data(), pixelCount, packedIndices.data());
+    });
+
+    auto unpackSeconds = measure([&]()
+    {
+      for(const auto& indexedFrame : indexedFrames)
+        unpackIndices(indexedFrame.palette.bits(), indexedFrame.packedIndices.data(), pixelCount, indexedFrame.palette.begin(), bitmap.data());
+    });
+
+    report("pack", 0, indexedFrames.size(), indicesSize, packedIndicesSize, packSeconds);
+    report("unpack", 0, indexedFrames.size(), indicesSize, packedIndicesSize, unpackSeconds);
+  }
+
+  {
+    // Planes of every frame are kept, so that merging reads distinct data.
+    std::vector<std::byte> planes(bitmapsSize);
+    std::vector<Color> bitmap(pixelCount);
+
+    auto splitSeconds = measure([&]()
+    {
+      for(std::size_t frameIdx = 0; frameIdx != frameCount; ++frameIdx)
+      {
+        auto framePlanes = planes.data() + frameIdx * pixelCount * sizeof(Color);
+        splitColorPlanes(reinterpret_cast<const std::byte*>(bitmaps[frameIdx].data()), pixelCount, framePlanes, framePlanes + pixelCount, framePlanes + 2 * pixelCount);
+      }
+    });
+
+    auto mergeSeconds = measure([&]()
+    {
+      for(std::size_t frameIdx = 0; frameIdx != frameCount; ++frameIdx)
+      {
+        auto framePlanes = planes.data() + frameIdx * pixelCount * sizeof(Color);
+        mergeColorPlanes(framePlanes, framePlanes + pixelCount, framePlanes + 2 * pixelCount, pixelCount, reinterpret_cast<std::byte*>(bitmap.data()));
+      }
+    });
+
+    report("split", 0, frameCount, bitmapsSize, 0, splitSeconds);
+    report("merge", 0, frameCount, bitmapsSize, 0, mergeSeconds);
+  }
+
+  for(auto level : levels)
+  {
+    // Same streaming mode as Encoder::compressBuffer, fed with packed indices.
+    if(!indexedFrames.empty())
+    {
+      std::vector<std::byte> compressedIndices(ZSTD_compressBound(pixelCount));
+      std::size_t compressedSize = 0;
+
+      auto seconds = measure([&]()
+      {
+        ZSTDCCtx zstdCompressor(ZSTD_createCCtx());
+
+        if(ZSTD_isError(ZSTD_CCtx_setParameter(zstdCompressor.get(), ZSTD_c_compressionLevel, level)))
+          throw std::runtime_error("Failed to set compression level.");
+
+        compressedSize = 0;
+
+        for(const auto& indexedFrame : indexedFrames)
+        {
+          ZSTD_inBuffer zstdInput = { indexedFrame.packedIndices.data(), indexedFrame.packedIndices.size(), 0 };
+          ZSTD_outBuffer zstdOutput = { compressedIndices.data(), compressedIndices.size(), 0 };
+
+          // Flush is complete once nothing is left buffered, which may take
+          // more calls than consuming the input.
+          std::size_t result = 0;
+
+          do
+          {
+            result = ZSTD_compressStream2(zstdCompressor.get(), &zstdOutput, &zstdInput, ZSTD_e_flush);
+
+            if(ZSTD_isError(result))
+              throw std::runtime_error(std::string("Compression failed: ") + ZSTD_getErrorName(result));
+          }
+          while(result != 0);
+
+          compressedSize += zstdOutput.pos;
+        }
+      });
+
+      report("compress", level, indexedFrames.size(), packedIndicesSize, compressedSize, seconds);
+    }
+
+    std::vector<std::vector<std::byte>> encodedFrames(frameCount);
+    std::size_t encodedSize = 0;
+
+    auto encodeSeconds = measure([&]()
+    {
+      Encoder encoder(bitmapInfo, EncoderSettings { true, level, 1 });
+      std::vector<std::byte> encoderBuffer(encoder.safeOutputBufferSize());
+
+      encodedSize = 0;
+
+      for(std::size_t frameIdx = 0; frameIdx != frameCount; ++frameIdx)
+      {
+        auto encodeResult = encoder.encode(static_cast<const Color*>(bitmaps[frameIdx].data()), encoderBuffer.data(), false);
+        encodedFrames[frameIdx].assign(encoderBuffer.begin(), encoderBuffer.begin() + encodeResult.bytesWritten);
+        encodedSize += encodeResult.bytesWritten;
+      }
+    });
+
+    std::vector<Color> bitmap(pixelCount);
+
+    auto decodeSeconds = measure([&]()
+    {
+      Decoder decoder(bitmapInfo);
+
+      for(const auto& encodedFrame : encodedFrames)
+        decoder.decodeInPlace(encodedFrame.data(), encodedFrame.size(), bitmap.data());
+    });
+
+    report("encode", level, frameCount, bitmapsSize, encodedSize, encodeSeconds);
+    report("decode", level, frameCount, bitmapsSize, encodedSize, decodeSeconds);
+  }
+
+  std::printf("\n");
+}
+
+
+} // namespace lpvc::bench
+
+
+int main(int argc, char** argv)
+{
+  std::size_t frameCount = 300;
+  std::vector<int> levels = { 1, 6, 12, 18 };
+  std::vector<std::string> paths;
+
+  for(int argIdx = 1; argIdx < argc; ++argIdx)
+  {
+    std::string arg = argv[argIdx];
+
+    if(arg == "--frames" && argIdx + 1 < argc)
+    {
+      frameCount = std::strtoul(argv[++argIdx], nullptr, 10);
+    }
+    else if(arg == "--levels" && argIdx + 1 < argc)
+    {
+      levels.clear();
+
+      for(auto level = std::strtok(argv[++argIdx], ","); level; level = std::strtok(nullptr, ","))
+        levels.push_back(std::atoi(level));
+    }
+    else
+    {
+      paths.push_back(arg);
+    }
+  }
+
+  if(paths.empty())
+  {
+    paths.push_back(LIBLPVC_BENCH_SAMPLE_DIR "/video001.avi");
+    paths.push_back(LIBLPVC_BENCH_SAMPLE_DIR "/video002.avi");
+  }
+
+  try
+  {
+    for(const auto& path : paths)
+      lpvc::bench::benchmarkFile(path, frameCount, levels);
+  }
+  catch(const std::exception& exception)
+  {
+    std::fprintf(stderr, "%s\n", exception.what());
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
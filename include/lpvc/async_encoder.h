@@ -0,0 +1,105 @@
+#ifndef LIBLPVC_ASYNC_ENCODER_H
+#define LIBLPVC_ASYNC_ENCODER_H
+
+#include <lpvc/detail/spsc_ring.h>
+#include <lpvc/lpvc.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace lpvc
+{
+
+
+// ===========================================================================
+//  AsyncEncoder
+// ===========================================================================
+
+// Moves encoding off the capturing thread. Frames are copied into a
+// lock-free ring of preallocated slots and encoded in two pipeline stages,
+// so submitting a frame costs a single copy. Analysis thread analyses frames
+// and packs their blocks, compression thread compresses them, packing the
+// next frame while the previous one is compressed. Encoded frames are passed
+// to the callback in order, on the compression thread. Errors thrown while
+// encoding, including those thrown by the callback, are rethrown by the next
+// encode(), tryEncode() or flush() call. Encoding restarts with a key frame
+// then, frames packed in the meantime are dropped. Frames already submitted
+// are encoded before destruction completes.
+
+class AsyncEncoder final
+{
+public:
+  using OutputCallback = std::function<void(const std::byte* frame, const Encoder::EncodeResult& encodeResult)>;
+
+  static constexpr std::size_t defaultSlotCount = 8;
+
+  AsyncEncoder(const BitmapInfo& bitmapInfo,
+               const EncoderSettings& settings,
+               OutputCallback outputCallback,
+               std::size_t slotCount = defaultSlotCount);
+  ~AsyncEncoder();
+
+  AsyncEncoder(const AsyncEncoder&) = delete;
+  AsyncEncoder& operator=(const AsyncEncoder&) = delete;
+
+  // Waits for a free slot if all of them are taken.
+  template<typename BitmapIterator>
+  void encode(BitmapIterator bitmapIterator, bool keyFrame);
+
+  // Returns false (frame is not submitted) if all slots are taken.
+  template<typename BitmapIterator>
+  bool tryEncode(BitmapIterator bitmapIterator, bool keyFrame);
+
+  // Waits until all submitted frames are encoded.
+  void flush();
+
+private:
+  struct FrameSlot
+  {
+    std::vector<Color> bitmap;
+    bool keyFrame = false;
+  };
+
+  void setError();
+  void rethrowError();
+  FrameSlot* waitForSlot();
+  void submitFrame();
+  void analysisThread();
+  void compressionThread();
+
+  std::size_t pixelCount_;
+  Encoder encoder_;
+  OutputCallback outputCallback_;
+  SPSCRing<FrameSlot> frameRing_;
+  Encoder::PackedFrame packedFrames_[2]; // Filled and compressed in turns.
+  std::size_t packedFrameCount_ = 0; // Packed, not yet compressed.
+  bool restartStream_ = false; // Compression failed, next frame must be a key frame.
+  std::mutex mutex_;
+  std::condition_variable frameSubmitted_;
+  std::condition_variable frameEncoded_;
+  std::condition_variable framePacked_;
+  std::condition_variable frameCompressed_;
+  std::atomic<bool> workerWaiting_ { false };
+  std::atomic<bool> producerWaiting_ { false };
+  std::atomic<bool> failed_ { false };
+  std::exception_ptr error_;
+  bool stopping_ = false;
+  bool analysisStopped_ = false;
+  std::thread analysisThread_;
+  std::thread compressionThread_;
+};
+
+
+} // namespace lpvc
+
+
+#include <lpvc/detail/async_encoder_impl.h>
+
+
+#endif // LIBLPVC_ASYNC_ENCODER_H
@@ -0,0 +1,110 @@
+#ifndef LIBLPVC_CONTAINER_H
+#define LIBLPVC_CONTAINER_H
+
+#include <lpvc/detail/mapped_file.h>
+#include <lpvc/lpvc.h>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+
+namespace lpvc
+{
+
+
+// ===========================================================================
+//  ContainerWriter
+// ===========================================================================
+
+// Native LPVC container (all values little endian):
+//
+//   Header       Magic "LPVC", uint16 format version, uint16 reserved,
+//                uint32 width, uint32 height, uint64 frame count,
+//                uint64 frame table offset
+//   Frame data   Encoded frames, back to back
+//   Frame table  Per frame: uint64 offset, uint32 size, uint8 flags
+//
+// Frame table is written by finish(), header fields referring to it are
+// filled in at the same time.
+
+class ContainerWriter final
+{
+public:
+  ContainerWriter(const std::string& path, const BitmapInfo& bitmapInfo);
+  ~ContainerWriter();
+
+  ContainerWriter(const ContainerWriter&) = delete;
+  ContainerWriter& operator=(const ContainerWriter&) = delete;
+
+  void write(const std::byte* frame, std::size_t frameSize, bool keyFrame);
+
+  // Called by the destructor if not called before (errors are ignored then).
+  void finish();
+
+private:
+  struct FrameEntry
+  {
+    std::uint64_t offset;
+    std::uint32_t size;
+    bool keyFrame;
+  };
+
+  std::ofstream file_;
+  BitmapInfo bitmapInfo_;
+  std::uint64_t offset_ = 0;
+  std::vector<FrameEntry> frameTable_;
+  bool finished_ = false;
+};
+
+
+// ===========================================================================
+//  ContainerReader
+// ===========================================================================
+
+// Reads containers written by ContainerWriter through a memory mapping.
+// Frame data points straight into the mapping, it's valid for the lifetime
+// of the reader.
+
+class ContainerReader final
+{
+public:
+  struct Frame
+  {
+    const std::byte* data = nullptr;
+    std::size_t size = 0;
+    bool keyFrame = false;
+  };
+
+  explicit ContainerReader(const std::string& path);
+
+  ContainerReader(const ContainerReader&) = delete;
+  ContainerReader& operator=(const ContainerReader&) = delete;
+
+  const BitmapInfo& bitmapInfo() const noexcept;
+  std::size_t frameCount() const noexcept;
+  Frame frame(std::size_t frameIndex) const;
+
+  // Index of the nearest key frame at or before the given frame.
+  std::size_t keyFrameIndex(std::size_t frameIndex) const;
+
+private:
+  MappedFile file_;
+  BitmapInfo bitmapInfo_;
+  std::size_t frameCount_ = 0;
+  const std::byte* frameTable_ = nullptr;
+  std::vector<std::size_t> keyFrames_;
+  std::uint64_t id_ = 0; // Unique among readers, unlike their addresses, which may be reused.
+
+  friend class Decoder;
+};
+
+
+} // namespace lpvc
+
+
+#include <lpvc/detail/container_impl.h>
+
+
+#endif // LIBLPVC_CONTAINER_H
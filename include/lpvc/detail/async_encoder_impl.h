@@ -0,0 +1,45 @@
+#ifndef LIBLPVC_DETAIL_ASYNC_ENCODER_IMPL_H
+#define LIBLPVC_DETAIL_ASYNC_ENCODER_IMPL_H
+
+#include <algorithm>
+
+
+namespace lpvc
+{
+
+
+template<typename BitmapIterator>
+void AsyncEncoder::encode(BitmapIterator bitmapIterator, bool keyFrame)
+{
+  auto frameSlot = waitForSlot();
+
+  std::copy_n(bitmapIterator, pixelCount_, frameSlot->bitmap.data());
+  frameSlot->keyFrame = keyFrame;
+
+  submitFrame();
+}
+
+
+template<typename BitmapIterator>
+bool AsyncEncoder::tryEncode(BitmapIterator bitmapIterator, bool keyFrame)
+{
+  rethrowError();
+
+  auto frameSlot = frameRing_.back();
+
+  if(!frameSlot)
+    return false;
+
+  std::copy_n(bitmapIterator, pixelCount_, frameSlot->bitmap.data());
+  frameSlot->keyFrame = keyFrame;
+
+  submitFrame();
+
+  return true;
+}
+
+
+} // namespace lpvc
+
+
+#endif // LIBLPVC_DETAIL_ASYNC_ENCODER_IMPL_H
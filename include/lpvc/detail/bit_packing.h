@@ -0,0 +1,233 @@
+#ifndef LIBLPVC_DETAIL_BIT_PACKING_H
+#define LIBLPVC_DETAIL_BIT_PACKING_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+  #define LIBLPVC_AVX2
+  #include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define LIBLPVC_SSE2
+  #include <emmintrin.h>
+#endif
+
+
+namespace lpvc
+{
+
+
+// ===========================================================================
+//  Index packing
+// ===========================================================================
+
+// Indices are packed starting from the least significant bits of each byte,
+// i.e. with 2-bit indices the first index of a byte occupies bits 0-1, the
+// second one bits 2-3 and so on. Only 1, 2, 4 and 8 bits per index are
+// supported.
+
+namespace detail
+{
+
+template<std::size_t Bits>
+struct IndexPacking
+{
+  static_assert(Bits == 1 || Bits == 2 || Bits == 4 || Bits == 8);
+
+  static constexpr std::size_t indicesPerByte = 8 / Bits;
+  static constexpr unsigned int indexMask = (1u << Bits) - 1;
+
+  static std::size_t packedSize(std::size_t count) noexcept
+  {
+    return (count + indicesPerByte - 1) / indicesPerByte;
+  }
+
+  static void packScalar(const std::uint8_t* indices, std::size_t count, std::uint8_t* output) noexcept
+  {
+    for(; count >= indicesPerByte; count -= indicesPerByte, indices += indicesPerByte)
+    {
+      unsigned int packed = 0;
+
+      for(std::size_t idx = 0; idx != indicesPerByte; ++idx)
+        packed |= static_cast<unsigned int>(indices[idx]) << (idx * Bits);
+
+      *output++ = static_cast<std::uint8_t>(packed);
+    }
+
+    if(count != 0)
+    {
+      unsigned int packed = 0;
+
+      for(std::size_t idx = 0; idx != count; ++idx)
+        packed |= static_cast<unsigned int>(indices[idx]) << (idx * Bits);
+
+      *output = static_cast<std::uint8_t>(packed);
+    }
+  }
+
+#if defined(LIBLPVC_SSE2)
+  // Packs 16 indices into 2 * Bits bytes.
+  static void pack16(const std::uint8_t* indices, std::uint8_t* output) noexcept
+  {
+    auto data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices));
+
+    if constexpr(Bits == 1)
+    {
+      auto packed = static_cast<std::uint16_t>(_mm_movemask_epi8(_mm_slli_epi16(data, 7)));
+      std::memcpy(output, &packed, sizeof(packed));
+    }
+    else if constexpr(Bits == 2)
+    {
+      data = _mm_and_si128(_mm_or_si128(data, _mm_srli_epi16(data, 6)), _mm_set1_epi16(0x000F));
+      data = _mm_packus_epi16(data, data);
+      data = _mm_and_si128(_mm_or_si128(data, _mm_srli_epi16(data, 4)), _mm_set1_epi16(0x00FF));
+      data = _mm_packus_epi16(data, data);
+
+      auto packed = static_cast<std::uint32_t>(_mm_cvtsi128_si32(data));
+      std::memcpy(output, &packed, sizeof(packed));
+    }
+    else if constexpr(Bits == 4)
+    {
+      data = _mm_and_si128(_mm_or_si128(data, _mm_srli_epi16(data, 4)), _mm_set1_epi16(0x00FF));
+      data = _mm_packus_epi16(data, data);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(output), data);
+    }
+  }
+#endif
+
+#if defined(LIBLPVC_AVX2)
+  // Packs 32 indices into 4 * Bits bytes.
+  static void pack32(const std::uint8_t* indices, std::uint8_t* output) noexcept
+  {
+    auto data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices));
+
+    if constexpr(Bits == 1)
+    {
+      auto packed = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_slli_epi16(data, 7)));
+      std::memcpy(output, &packed, sizeof(packed));
+    }
+    else if constexpr(Bits == 2)
+    {
+      data = _mm256_and_si256(_mm256_or_si256(data, _mm256_srli_epi16(data, 6)), _mm256_set1_epi16(0x000F));
+      data = _mm256_packus_epi16(data, data);
+      data = _mm256_and_si256(_mm256_or_si256(data, _mm256_srli_epi16(data, 4)), _mm256_set1_epi16(0x00FF));
+      data = _mm256_packus_epi16(data, data);
+
+      // Packing works within 128-bit lanes, each lane holds 4 output bytes.
+      auto lowPacked = static_cast<std::uint32_t>(_mm_cvtsi128_si32(_mm256_castsi256_si128(data)));
+      auto highPacked = static_cast<std::uint32_t>(_mm_cvtsi128_si32(_mm256_extracti128_si256(data, 1)));
+      std::memcpy(output, &lowPacked, sizeof(lowPacked));
+      std::memcpy(output + sizeof(lowPacked), &highPacked, sizeof(highPacked));
+    }
+    else if constexpr(Bits == 4)
+    {
+      data = _mm256_and_si256(_mm256_or_si256(data, _mm256_srli_epi16(data, 4)), _mm256_set1_epi16(0x00FF));
+      data = _mm256_packus_epi16(data, data);
+
+      // Packing works within 128-bit lanes, gather low 64 bits of both.
+      data = _mm256_permute4x64_epi64(data, 0x08);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output), _mm256_castsi256_si128(data));
+    }
+  }
+#endif
+
+  static void pack(const std::uint8_t* indices, std::size_t count, std::uint8_t* output) noexcept
+  {
+    if constexpr(Bits == 8)
+    {
+      std::memcpy(output, indices, count);
+    }
+    else
+    {
+#if defined(LIBLPVC_AVX2)
+      for(; count >= 32; count -= 32, indices += 32, output += 4 * Bits)
+        pack32(indices, output);
+#endif
+
+#if defined(LIBLPVC_SSE2)
+      for(; count >= 16; count -= 16, indices += 16, output += 2 * Bits)
+        pack16(indices, output);
+#endif
+
+      packScalar(indices, count, output);
+    }
+  }
+
+  // Expands packed indices straight into palette values. For sub-byte
+  // indices every possible input byte is first mapped to the run of values
+  // it encodes, so each input byte turns into a single fixed-size copy.
+  template<typename Value>
+  static void unpack(const std::uint8_t* input, std::size_t count, const Value* palette, Value* output) noexcept
+  {
+    if constexpr(Bits == 8)
+    {
+      for(std::size_t idx = 0; idx != count; ++idx)
+        output[idx] = palette[input[idx]];
+    }
+    else
+    {
+      std::array<Value, 256 * indicesPerByte> expansionTable;
+
+      for(std::size_t byte = 0; byte != 256; ++byte)
+      {
+        for(std::size_t idx = 0; idx != indicesPerByte; ++idx)
+          expansionTable[byte * indicesPerByte + idx] = palette[(byte >> (idx * Bits)) & indexMask];
+      }
+
+      for(; count >= indicesPerByte; count -= indicesPerByte, output += indicesPerByte)
+        std::memcpy(output, &expansionTable[*input++ * indicesPerByte], indicesPerByte * sizeof(Value));
+
+      if(count != 0)
+        std::memcpy(output, &expansionTable[*input * indicesPerByte], count * sizeof(Value));
+    }
+  }
+};
+
+
+template<typename Function>
+decltype(auto) dispatchIndexBits(std::size_t bits, Function&& function)
+{
+  switch(bits)
+  {
+  case 1: return function(IndexPacking<1>());
+  case 2: return function(IndexPacking<2>());
+  case 4: return function(IndexPacking<4>());
+  case 8: return function(IndexPacking<8>());
+  }
+
+  throw std::runtime_error("Invalid index bit count.");
+}
+
+} // namespace detail
+
+
+inline std::size_t packedIndicesSize(std::size_t bits, std::size_t count)
+{
+  return detail::dispatchIndexBits(bits, [&](auto packing) { return packing.packedSize(count); });
+}
+
+
+// Output must have room for packedIndicesSize(bits, count) bytes.
+inline void packIndices(std::size_t bits, const std::uint8_t* indices, std::size_t count, std::byte* output)
+{
+  detail::dispatchIndexBits(bits, [&](auto packing) { packing.pack(indices, count, reinterpret_cast<std::uint8_t*>(output)); });
+}
+
+
+// Palette must have room for (1 << bits) values.
+template<typename Value>
+void unpackIndices(std::size_t bits, const std::byte* input, std::size_t count, const Value* palette, Value* output)
+{
+  detail::dispatchIndexBits(bits, [&](auto packing) { packing.unpack(reinterpret_cast<const std::uint8_t*>(input), count, palette, output); });
+}
+
+
+} // namespace lpvc
+
+
+#endif // LIBLPVC_DETAIL_BIT_PACKING_H
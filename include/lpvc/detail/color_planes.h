@@ -0,0 +1,240 @@
+#ifndef LIBLPVC_DETAIL_COLOR_PLANES_H
+#define LIBLPVC_DETAIL_COLOR_PLANES_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSSE3__)
+  #define LIBLPVC_SSSE3
+  #include <tmmintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define LIBLPVC_SSE2
+  #include <emmintrin.h>
+#endif
+
+
+namespace lpvc
+{
+
+
+// ===========================================================================
+//  Color planes
+// ===========================================================================
+
+// Conversion between interleaved 3 byte pixels and separate planes holding
+// one byte of each pixel, see PlanarRawBitmapBlock.
+
+namespace detail
+{
+
+#if defined(LIBLPVC_SSSE3)
+// Shuffle masks moving bytes of 16 pixels (3 vectors) between layouts. Split
+// mask [plane][vector] gathers bytes of given plane found in given vector of
+// interleaved pixels, merge mask [vector][plane] scatters bytes of given
+// plane belonging to given vector of interleaved pixels. Bytes set to -1 are
+// zeroed by the shuffle.
+using PlaneShuffleMasks = std::array<std::array<std::array<std::int8_t, 16>, 3>, 3>;
+
+constexpr PlaneShuffleMasks makePlaneSplitMasks() noexcept
+{
+  PlaneShuffleMasks masks {};
+
+  for(std::size_t plane = 0; plane != 3; ++plane)
+  {
+    for(std::size_t vector = 0; vector != 3; ++vector)
+    {
+      for(std::size_t byte = 0; byte != 16; ++byte)
+      {
+        auto source = byte * 3 + plane;
+        masks[plane][vector][byte] = static_cast<std::int8_t>((source / 16 == vector) ? source % 16 : -1);
+      }
+    }
+  }
+
+  return masks;
+}
+
+
+constexpr PlaneShuffleMasks makePlaneMergeMasks() noexcept
+{
+  PlaneShuffleMasks masks {};
+
+  for(std::size_t vector = 0; vector != 3; ++vector)
+  {
+    for(std::size_t plane = 0; plane != 3; ++plane)
+    {
+      for(std::size_t byte = 0; byte != 16; ++byte)
+      {
+        auto destination = vector * 16 + byte;
+        masks[vector][plane][byte] = static_cast<std::int8_t>((destination % 3 == plane) ? destination / 3 : -1);
+      }
+    }
+  }
+
+  return masks;
+}
+
+
+inline __m128i loadShuffleMask(const std::array<std::int8_t, 16>& mask) noexcept
+{
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask.data()));
+}
+#elif defined(LIBLPVC_SSE2)
+// Without byte shuffles, pixels are widened to 4 bytes, which shifts and
+// packs can reach. Loads and stores take 8 bytes for 2 pixels, they touch 2
+// bytes past the 4 pixels handled.
+inline __m128i loadWidePixels(const std::uint8_t* input) noexcept
+{
+  const auto lowPixels = _mm_set1_epi64x(0x0000000000FFFFFF);
+  const auto highPixels = _mm_set1_epi64x(0x00FFFFFF00000000);
+
+  auto pixels = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(input)),
+                                   _mm_loadl_epi64(reinterpret_cast<const __m128i*>(input + 6)));
+
+  return _mm_or_si128(_mm_and_si128(pixels, lowPixels), _mm_and_si128(_mm_slli_epi64(pixels, 8), highPixels));
+}
+
+
+inline void storeWidePixels(__m128i pixels, std::uint8_t* output) noexcept
+{
+  const auto lowPixels = _mm_set1_epi64x(0x0000000000FFFFFF);
+  const auto highPixels = _mm_set1_epi64x(0x0000FFFFFF000000);
+
+  pixels = _mm_or_si128(_mm_and_si128(pixels, lowPixels), _mm_and_si128(_mm_srli_epi64(pixels, 8), highPixels));
+
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(output), pixels);
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(output + 6), _mm_srli_si128(pixels, 8));
+}
+#endif
+
+} // namespace detail
+
+
+// Planes must have room for count bytes each.
+inline void splitColorPlanes(const std::byte* colors, std::size_t count, std::byte* plane0, std::byte* plane1, std::byte* plane2) noexcept
+{
+  auto input = reinterpret_cast<const std::uint8_t*>(colors);
+  std::uint8_t* planes[3] = { reinterpret_cast<std::uint8_t*>(plane0), reinterpret_cast<std::uint8_t*>(plane1), reinterpret_cast<std::uint8_t*>(plane2) };
+  std::size_t idx = 0;
+
+#if defined(LIBLPVC_SSSE3)
+  static constexpr auto masks = detail::makePlaneSplitMasks();
+
+  for(; idx + 16 <= count; idx += 16)
+  {
+    __m128i vectors[3];
+
+    for(std::size_t vector = 0; vector != 3; ++vector)
+      vectors[vector] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + idx * 3 + vector * 16));
+
+    for(std::size_t plane = 0; plane != 3; ++plane)
+    {
+      auto bytes = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vectors[0], detail::loadShuffleMask(masks[plane][0])),
+                                             _mm_shuffle_epi8(vectors[1], detail::loadShuffleMask(masks[plane][1]))),
+                                             _mm_shuffle_epi8(vectors[2], detail::loadShuffleMask(masks[plane][2])));
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[plane] + idx), bytes);
+    }
+  }
+#elif defined(LIBLPVC_SSE2)
+  // Last wide load reads past the 16 pixels, at least one more must follow.
+  const auto byteMask = _mm_set1_epi32(0xFF);
+
+  for(; idx + 16 < count; idx += 16)
+  {
+    __m128i planeVectors[3][4];
+
+    for(std::size_t vector = 0; vector != 4; ++vector)
+    {
+      auto pixels = detail::loadWidePixels(input + (idx + vector * 4) * 3);
+
+      planeVectors[0][vector] = _mm_and_si128(pixels, byteMask);
+      planeVectors[1][vector] = _mm_and_si128(_mm_srli_epi32(pixels, 8), byteMask);
+      planeVectors[2][vector] = _mm_srli_epi32(pixels, 16);
+    }
+
+    for(std::size_t plane = 0; plane != 3; ++plane)
+    {
+      auto bytes = _mm_packus_epi16(_mm_packs_epi32(planeVectors[plane][0], planeVectors[plane][1]),
+                                    _mm_packs_epi32(planeVectors[plane][2], planeVectors[plane][3]));
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(planes[plane] + idx), bytes);
+    }
+  }
+#endif
+
+  for(; idx < count; ++idx)
+  {
+    planes[0][idx] = input[idx * 3 + 0];
+    planes[1][idx] = input[idx * 3 + 1];
+    planes[2][idx] = input[idx * 3 + 2];
+  }
+}
+
+
+// Colors must have room for count pixels.
+inline void mergeColorPlanes(const std::byte* plane0, const std::byte* plane1, const std::byte* plane2, std::size_t count, std::byte* colors) noexcept
+{
+  auto output = reinterpret_cast<std::uint8_t*>(colors);
+  const std::uint8_t* planes[3] = { reinterpret_cast<const std::uint8_t*>(plane0), reinterpret_cast<const std::uint8_t*>(plane1), reinterpret_cast<const std::uint8_t*>(plane2) };
+  std::size_t idx = 0;
+
+#if defined(LIBLPVC_SSSE3)
+  static constexpr auto masks = detail::makePlaneMergeMasks();
+
+  for(; idx + 16 <= count; idx += 16)
+  {
+    __m128i vectors[3];
+
+    for(std::size_t plane = 0; plane != 3; ++plane)
+      vectors[plane] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[plane] + idx));
+
+    for(std::size_t vector = 0; vector != 3; ++vector)
+    {
+      auto bytes = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vectors[0], detail::loadShuffleMask(masks[vector][0])),
+                                             _mm_shuffle_epi8(vectors[1], detail::loadShuffleMask(masks[vector][1]))),
+                                             _mm_shuffle_epi8(vectors[2], detail::loadShuffleMask(masks[vector][2])));
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + idx * 3 + vector * 16), bytes);
+    }
+  }
+#elif defined(LIBLPVC_SSE2)
+  // Last wide store writes past the 16 pixels, at least one more must follow.
+  const auto zero = _mm_setzero_si128();
+
+  for(; idx + 16 < count; idx += 16)
+  {
+    __m128i vectors[3];
+
+    for(std::size_t plane = 0; plane != 3; ++plane)
+      vectors[plane] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[plane] + idx));
+
+    auto lowPairs = _mm_unpacklo_epi8(vectors[0], vectors[1]);
+    auto highPairs = _mm_unpackhi_epi8(vectors[0], vectors[1]);
+    auto lowLast = _mm_unpacklo_epi8(vectors[2], zero);
+    auto highLast = _mm_unpackhi_epi8(vectors[2], zero);
+    auto vectorOutput = output + idx * 3;
+
+    detail::storeWidePixels(_mm_unpacklo_epi16(lowPairs, lowLast), vectorOutput + 0);
+    detail::storeWidePixels(_mm_unpackhi_epi16(lowPairs, lowLast), vectorOutput + 12);
+    detail::storeWidePixels(_mm_unpacklo_epi16(highPairs, highLast), vectorOutput + 24);
+    detail::storeWidePixels(_mm_unpackhi_epi16(highPairs, highLast), vectorOutput + 36);
+  }
+#endif
+
+  for(; idx < count; ++idx)
+  {
+    output[idx * 3 + 0] = planes[0][idx];
+    output[idx * 3 + 1] = planes[1][idx];
+    output[idx * 3 + 2] = planes[2][idx];
+  }
+}
+
+
+} // namespace lpvc
+
+
+#endif // LIBLPVC_DETAIL_COLOR_PLANES_H
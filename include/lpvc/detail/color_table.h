@@ -0,0 +1,133 @@
+#ifndef LIBLPVC_DETAIL_COLOR_TABLE_H
+#define LIBLPVC_DETAIL_COLOR_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+
+namespace lpvc
+{
+
+
+// ===========================================================================
+//  ColorTable
+// ===========================================================================
+
+// Fixed-capacity open addressing hash table keyed by packed 24-bit colors.
+// All storage is allocated up front, so neither insertions nor clear() touch
+// the heap. Table is kept at most half full to keep probe sequences short.
+
+template<typename Value, std::size_t Capacity>
+class ColorTable final
+{
+public:
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two.");
+
+  static constexpr std::size_t maxSize = Capacity / 2;
+
+  ColorTable() :
+    slots_(Capacity),
+    usedSlots_(maxSize)
+  {
+  }
+
+  std::size_t size() const noexcept
+  {
+    return size_;
+  }
+
+  void clear() noexcept
+  {
+    for(std::size_t idx = 0; idx != size_; ++idx)
+      slots_[usedSlots_[idx]].key = emptyKey;
+
+    size_ = 0;
+  }
+
+  // Returns keys in insertion order.
+  std::uint32_t key(std::size_t index) const noexcept
+  {
+    return slots_[usedSlots_[index]].key;
+  }
+
+  Value* find(std::uint32_t key) noexcept
+  {
+    for(auto slotIdx = hash(key); ; slotIdx = (slotIdx + 1) & (Capacity - 1))
+    {
+      auto& slot = slots_[slotIdx];
+
+      if(slot.key == key)
+        return &slot.value;
+
+      if(slot.key == emptyKey)
+        return nullptr;
+    }
+  }
+
+  const Value* find(std::uint32_t key) const noexcept
+  {
+    return const_cast<ColorTable*>(this)->find(key);
+  }
+
+  // Returns false if key was already present (its value is left untouched).
+  bool insert(std::uint32_t key, const Value& value)
+  {
+    for(auto slotIdx = hash(key); ; slotIdx = (slotIdx + 1) & (Capacity - 1))
+    {
+      auto& slot = slots_[slotIdx];
+
+      if(slot.key == key)
+        return false;
+
+      if(slot.key == emptyKey)
+      {
+        if(size_ == maxSize)
+          throw std::length_error("Color table is full.");
+
+        slot.key = key;
+        slot.value = value;
+        usedSlots_[size_++] = slotIdx;
+
+        return true;
+      }
+    }
+  }
+
+private:
+  // Packed colors never use the most significant byte.
+  static constexpr std::uint32_t emptyKey = 0xFFFFFFFF;
+
+  struct Slot
+  {
+    std::uint32_t key = emptyKey;
+    Value value {};
+  };
+
+  static constexpr std::size_t capacityBits() noexcept
+  {
+    std::size_t bits = 0;
+
+    while((std::size_t(1) << bits) != Capacity)
+      ++bits;
+
+    return bits;
+  }
+
+  static std::size_t hash(std::uint32_t key) noexcept
+  {
+    // Fibonacci hashing - spreads neighbouring colors over the whole table.
+    return static_cast<std::uint32_t>(key * 0x9E3779B1u) >> (32 - capacityBits());
+  }
+
+  std::vector<Slot> slots_;
+  std::vector<std::size_t> usedSlots_;
+  std::size_t size_ = 0;
+};
+
+
+} // namespace lpvc
+
+
+#endif // LIBLPVC_DETAIL_COLOR_TABLE_H
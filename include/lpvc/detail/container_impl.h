@@ -0,0 +1,34 @@
+#ifndef LIBLPVC_DETAIL_CONTAINER_IMPL_H
+#define LIBLPVC_DETAIL_CONTAINER_IMPL_H
+
+#include <cstddef>
+
+
+namespace lpvc
+{
+
+
+template<typename BitmapIterator>
+Decoder::DecodeResult Decoder::seek(const ContainerReader& containerReader, std::size_t frameIndex, BitmapIterator bitmapIterator)
+{
+  // Frames in between are decoded only to serve as references.
+  for(auto frameIdx = seekStart(containerReader, frameIndex); frameIdx != frameIndex; ++frameIdx)
+  {
+    auto frame = containerReader.frame(frameIdx);
+    decodeFrame(frame.data, frame.size, ownedBitmap());
+  }
+
+  auto frame = containerReader.frame(frameIndex);
+  auto decodeResult = decode(frame.data, frame.size, bitmapIterator);
+
+  seekContainerId_ = containerReader.id_;
+  seekFrameIndex_ = frameIndex;
+
+  return decodeResult;
+}
+
+
+} // namespace lpvc
+
+
+#endif // LIBLPVC_DETAIL_CONTAINER_IMPL_H
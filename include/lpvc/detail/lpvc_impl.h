@@ -2,7 +2,9 @@
 #define LIBLPVC_DETAIL_LPVC_IMPL_H
 
 #include <algorithm>
-#include <set>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
 
 
 namespace lpvc
@@ -18,6 +20,22 @@ struct ColorOrdering final
 };
 
 
+inline std::uint32_t packColor(const Color& color) noexcept
+{
+  return (std::to_integer<std::uint32_t>(color.r) << 0) |
+         (std::to_integer<std::uint32_t>(color.g) << 8) |
+         (std::to_integer<std::uint32_t>(color.b) << 16);
+}
+
+
+inline Color unpackColor(std::uint32_t packedColor) noexcept
+{
+  return { static_cast<std::byte>(packedColor >> 0),
+           static_cast<std::byte>(packedColor >> 8),
+           static_cast<std::byte>(packedColor >> 16) };
+}
+
+
 template<typename ColorIterator>
 Palette::Palette(ColorIterator begin, ColorIterator end) :
   size_(std::distance(begin, end))
@@ -32,116 +50,261 @@ Palette::Palette(ColorIterator begin, ColorIterator end) :
 template<typename BitmapIterator>
 Encoder::EncodeResult Encoder::encode(BitmapIterator bitmapIterator, std::byte* outputBuffer, bool keyFrame)
 {
+  Stopwatch stopwatch(statsEnabled_ || settings_.frameTimeBudget > 0);
   BufferWriter bufferWriter(outputBuffer, safeOutputBufferSize());
 
+  if(statsEnabled_)
+    frameStats_ = {};
+
+  auto frameType = writeFrame(bitmapIterator, bufferWriter, keyFrame);
+  auto frameTime = stopwatch.elapsed();
+
+  if(statsEnabled_)
+    updateStats(bufferWriter.offset(), frameType.keyFrame, frameTime);
+
+  // Null frames take no compression, their time says nothing about the level.
+  if(settings_.frameTimeBudget > 0 && !frameType.nullFrame)
+  {
+    adjustCompressionLevel(frameTime);
+    applyCompressionLevel(compressionLevel_);
+  }
+
+  return { bufferWriter.offset(), frameType.keyFrame };
+}
+
+
+template<typename BitmapIterator>
+Encoder::FrameType Encoder::writeFrame(BitmapIterator bitmapIterator, BufferWriter& bufferWriter, bool keyFrame)
+{
   if(firstFrame_)
   {
     firstFrame_ = false;
     keyFrame = true;
   }
 
+  if(settings_.maxKeyFrameInterval > 0 &&
+     keyFrameDistance_ + 1 >= static_cast<std::size_t>(settings_.maxKeyFrameInterval))
+  {
+    keyFrame = true;
+  }
+
   if(keyFrame)
     writeBlock<KeyFrameBlock>(bufferWriter);
 
-  if(!previousFrameBitmap_.empty() &&
-     std::equal(previousFrameBitmap_.begin(), previousFrameBitmap_.end(), bitmapIterator))
+  auto frameAnalysis = analyzeFrame(bitmapIterator);
+
+  // Scene change key frame is placed after analysis, which doesn't depend on
+  // the reset done by the key frame. Null frames are never scene changes.
+  if(!keyFrame && isSceneChange(frameAnalysis))
+  {
+    writeBlock<KeyFrameBlock>(bufferWriter);
+
+    keyFrame = true;
+    frameAnalysis.nullFrame = false;
+  }
+
+  keyFrameDistance_ = keyFrame ? 0 : keyFrameDistance_ + 1;
+
+  if(!frameAnalysis.nullFrame &&
+     previousFrameValid_ &&
+     settings_.scrollSearchRadius > 0)
+  {
+    if(auto scroll = findScroll())
+    {
+      writeBlock<ScrollBlock>(bufferWriter, scroll->x, scroll->y);
+
+      frameAnalysis.nullFrame = (scroll->changedPixelCount == 0);
+      frameAnalysis.changedPixelCount = scroll->changedPixelCount;
+
+      // Exposed pixels may have colors missing from the palette, no bitmap
+      // block follows to add them.
+      if(frameAnalysis.nullFrame)
+        previousFrameInPalette_ = false;
+    }
+  }
+
+  if(frameAnalysis.nullFrame)
   {
     writeBlock<NullBitmapBlock>(bufferWriter);
   }
   else
   {
-    if(settings_.usePalette)
+    if(frameAnalysis.palette && frameAnalysis.palette->size() == 1)
     {
-      auto newPalette = makePalette(bitmapIterator);
+      writeBlock<SolidColorBitmapBlock>(bufferWriter, (*frameAnalysis.palette)[0]);
 
-      if(newPalette)
+      // Solid color frames leave the palette intact, their color may be
+      // missing from it.
+      previousFrameInPalette_ = (colorMap_.find(packColor((*frameAnalysis.palette)[0])) != nullptr);
+    }
+    else
+    {
+      auto dirtyTiles = settings_.useDirtyTiles &&
+                        previousFrameValid_ &&
+                        findDirtyTiles() * dirtyTileRatio <= dirtyTiles_.size();
+
+      if(dirtyTiles)
+        writeBlock<DirtyTilesBlock>(bufferWriter);
+
+      if(frameAnalysis.palette)
       {
-        if(newPalette->size() == 1)
+        auto paletteOffset = bufferWriter.offset();
+
+        updatePalette(bufferWriter, *frameAnalysis.palette);
+
+        // Residual can win only when most of the frame stays the same.
+        // Palette reset in updatePalette disqualifies the previous frame.
+        if(settings_.useResidual &&
+           !dirtyTiles &&
+           previousFrameInPalette_ &&
+           frameAnalysis.changedPixelCount * residualPixelRatio <= frameBitmap_.size() &&
+           residualWins(bufferWriter.offset() != paletteOffset))
         {
-          writeBlock<SolidColorBitmapBlock>(bufferWriter, (*newPalette)[0]);
+          writeBlock<IndexedResidualBitmapBlock>(bufferWriter);
         }
         else
         {
-          updatePalette(bufferWriter, *newPalette);
-          copyFrameBitmap(bitmapIterator);
           writeBlock<IndexedBitmapBlock>(bufferWriter);
         }
+
+        previousFrameInPalette_ = true;
+      }
+      else if(settings_.useWidePalette && makeWidePalette())
+      {
+        updateWidePalette(bufferWriter);
+        writeBlock<WideIndexedBitmapBlock>(bufferWriter);
+        previousFrameInPalette_ = false;
       }
       else
       {
-        copyFrameBitmap(bitmapIterator);
-        writeBlock<RawBitmapBlock>(bufferWriter);
+        if(settings_.useRawFilters && !dirtyTiles)
+          writeBlock<FilteredRawBitmapBlock>(bufferWriter);
+        else if(settings_.usePlanarRaw && prefersPlanarRaw())
+          writeBlock<PlanarRawBitmapBlock>(bufferWriter);
+        else
+          writeBlock<RawBitmapBlock>(bufferWriter);
+
+        previousFrameInPalette_ = false;
       }
-    }
-    else
-    {
-      copyFrameBitmap(bitmapIterator);
-      writeBlock<RawBitmapBlock>(bufferWriter);
+
+      tileBitmap_.clear();
     }
 
-    previousFrameBitmap_ = frameBitmap_;
+    // Buffer of the older frame is reused for the next one.
+    frameBitmap_.swap(previousFrameBitmap_);
+    previousFrameValid_ = true;
   }
 
-  return { bufferWriter.offset(), keyFrame };
+  return { keyFrame, frameAnalysis.nullFrame };
 }
 
 
 template<typename Block, typename ...Args>
 void Encoder::writeBlock(BufferWriter& bufferWriter, Args&& ...args)
 {
-  bufferWriter.writeUInt8(variant_type_index<Block, FrameBlock>());
+  constexpr auto blockId = variant_type_index<Block, FrameBlock>();
+
+  if(!statsEnabled_)
+  {
+    bufferWriter.writeUInt8(blockId);
+    Block().encode(*this, bufferWriter, std::forward<Args>(args)...);
+    return;
+  }
+
+  Stopwatch stopwatch;
+  auto offset = bufferWriter.offset();
+  auto zstdTime = frameStats_.zstdTime;
+
+  bufferWriter.writeUInt8(blockId);
   Block().encode(*this, bufferWriter, std::forward<Args>(args)...);
+
+  frameStats_.blockCounts[blockId] += 1;
+  frameStats_.blockSizes[blockId] += bufferWriter.offset() - offset;
+  frameStats_.packingTime += stopwatch.elapsed() - (frameStats_.zstdTime - zstdTime);
 }
 
 
 template<typename BitmapIterator>
-void Encoder::copyFrameBitmap(BitmapIterator bitmapIterator)
+Encoder::FrameAnalysis Encoder::analyzeFrame(BitmapIterator bitmapIterator)
 {
-  std::copy_n(bitmapIterator, bitmapInfo_.width * bitmapInfo_.height, frameBitmap_.begin());
-}
+  // Input is read exactly once. Each chunk is copied to frameBitmap_ first,
+  // then the comparison with previous frame and palette creation work on
+  // that copy while it's still in cache.
+  constexpr std::size_t chunkSize = 4096;
+
+  Stopwatch stopwatch(statsEnabled_);
+  const auto pixelCount = frameBitmap_.size();
+  const auto countChanges = (settings_.usePalette && settings_.useResidual && previousFrameInPalette_) ||
+                            (settings_.maxKeyFrameInterval > 0 && previousFrameValid_);
+  auto nullFrame = previousFrameValid_;
+  auto paletteValid = settings_.usePalette;
+  std::size_t paletteOffset = 0;
+  FrameAnalysis frameAnalysis;
+
+  paletteBuilder_.clear();
+
+  for(std::size_t chunkOffset = 0; chunkOffset < pixelCount; chunkOffset += chunkSize)
+  {
+    auto chunkSizeClamped = std::min(chunkSize, pixelCount - chunkOffset);
+    auto chunk = frameBitmap_.data() + chunkOffset;
 
+    if constexpr(std::is_convertible_v<BitmapIterator, const Color*>)
+    {
+      std::memcpy(chunk, static_cast<const Color*>(bitmapIterator) + chunkOffset, chunkSizeClamped * sizeof(Color));
+    }
+    else if constexpr(IsFormattedBitmap<BitmapIterator>::value)
+    {
+      readFormattedBitmap(bitmapIterator, chunkOffset, chunkSizeClamped, chunk);
+    }
+    else
+    {
+      for(std::size_t colorIdx = 0; colorIdx != chunkSizeClamped; ++colorIdx, ++bitmapIterator)
+        chunk[colorIdx] = *bitmapIterator;
+    }
 
-template<typename BitmapIterator>
-std::optional<Palette> Encoder::makePalette(BitmapIterator bitmapIterator)
-{
-  // TODO: Instead of using heap-allocated std::set consider smarter implementation of Palette (fixed-size dynamic array?)
-  std::set<Color, ColorOrdering> colorSet;
+    if(nullFrame || countChanges)
+    {
+      auto previousChunk = previousFrameBitmap_.data() + chunkOffset;
 
-  for(std::size_t colorIdx = 0; colorIdx != bitmapInfo_.width * bitmapInfo_.height; ++bitmapIterator, ++colorIdx)
-  {
-    colorSet.insert(*bitmapIterator);
+      if(std::memcmp(chunk, previousChunk, chunkSizeClamped * sizeof(Color)) != 0)
+      {
+        nullFrame = false;
+
+        if(countChanges)
+        {
+          for(std::size_t colorIdx = 0; colorIdx != chunkSizeClamped; ++colorIdx)
+            frameAnalysis.changedPixelCount += (packColor(chunk[colorIdx]) != packColor(previousChunk[colorIdx]));
+        }
+      }
+    }
 
-    if(colorSet.size() > Palette::maxColorCount)
-      return std::nullopt;
+    // Null frames don't need a palette. Colors are added only once the frame
+    // is known to differ from the previous one, catching up on skipped chunks.
+    if(!nullFrame && paletteValid)
+    {
+      paletteValid = addPaletteColors(frameBitmap_.data() + paletteOffset, chunk + chunkSizeClamped);
+      paletteOffset = chunkOffset + chunkSizeClamped;
+    }
   }
 
-  return Palette(colorSet.begin(), colorSet.end());
+  frameAnalysis.nullFrame = nullFrame;
+
+  if(!nullFrame && paletteValid)
+    frameAnalysis.palette = makePalette();
+
+  if(statsEnabled_)
+    frameStats_.analysisTime += stopwatch.elapsed();
+
+  return frameAnalysis;
 }
 
 
 template<typename BitmapIterator>
 Decoder::DecodeResult Decoder::decode(const std::byte* inputBuffer, std::size_t inputBufferSize, BitmapIterator bitmapIterator)
 {
-  BufferReader bufferReader(inputBuffer, inputBufferSize);
-
-  result_ = {};
-
-  while(bufferReader.offset() != bufferReader.size())
-  {
-    auto frameBlockId = bufferReader.readUInt8();
-    auto block = make_variant<FrameBlock>(frameBlockId);
-
-    std::visit(
-      [&, this](auto& block)
-      {
-        block.decode(*this, bufferReader);
-      },
-      block
-    );
-  }
+  decodeFrame(inputBuffer, inputBufferSize, ownedBitmap());
 
-  std::copy(frameBitmap_.begin(), frameBitmap_.end(), bitmapIterator);
-  previousFrameBitmap_ = frameBitmap_;
+  std::copy(previousFrame_, previousFrame_ + pixelCount(), bitmapIterator);
 
   return result_;
 }
@@ -0,0 +1,49 @@
+#ifndef LIBLPVC_DETAIL_MAPPED_FILE_H
+#define LIBLPVC_DETAIL_MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+
+namespace lpvc
+{
+
+
+// ===========================================================================
+//  MappedFile
+// ===========================================================================
+
+// Read-only memory mapping of a whole file. Platform specific parts live in
+// container.cpp, so system headers don't leak into the public interface.
+
+class MappedFile final
+{
+public:
+  explicit MappedFile(const std::string& path);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const std::byte* data() const noexcept
+  {
+    return data_;
+  }
+
+  std::size_t size() const noexcept
+  {
+    return size_;
+  }
+
+private:
+  const std::byte* data_ = nullptr;
+  std::size_t size_ = 0;
+  void* fileHandle_ = nullptr;
+  void* mappingHandle_ = nullptr;
+};
+
+
+} // namespace lpvc
+
+
+#endif // LIBLPVC_DETAIL_MAPPED_FILE_H
@@ -0,0 +1,22 @@
+#ifndef LIBLPVC_DETAIL_PARALLEL_ENCODER_IMPL_H
+#define LIBLPVC_DETAIL_PARALLEL_ENCODER_IMPL_H
+
+#include <algorithm>
+
+
+namespace lpvc
+{
+
+
+template<typename BitmapIterator>
+void ParallelEncoder::encode(BitmapIterator bitmapIterator, bool keyFrame)
+{
+  std::copy_n(bitmapIterator, bitmapInfo_.width * bitmapInfo_.height, beginFrame(keyFrame));
+  endFrame();
+}
+
+
+} // namespace lpvc
+
+
+#endif // LIBLPVC_DETAIL_PARALLEL_ENCODER_IMPL_H
@@ -54,77 +54,92 @@ public:
   }
 
   template<typename T>
-  auto& writeInt8(T value)
+  std::size_t writeInt8(T value)
   {
     return write<std::uint8_t>(value);
   }
 
   template<typename T>
-  auto& writeInt16(T value)
+  std::size_t writeInt16(T value)
   {
     return write<std::uint16_t>(value);
   }
 
   template<typename T>
-  auto& writeInt32(T value)
+  std::size_t writeInt32(T value)
   {
     return write<std::uint32_t>(value);
   }
 
   template<typename T>
-  auto& writeInt64(T value)
+  std::size_t writeInt64(T value)
   {
     return write<std::uint64_t>(value);
   }
 
   template<typename T>
-  auto& writeUInt8(T value)
+  std::size_t writeUInt8(T value)
   {
     return write<std::uint8_t>(value);
   }
 
   template<typename T>
-  auto& writeUInt16(T value)
+  std::size_t writeUInt16(T value)
   {
     return write<std::uint16_t>(value);
   }
 
   template<typename T>
-  auto& writeUInt32(T value)
+  std::size_t writeUInt32(T value)
   {
     return write<std::uint32_t>(value);
   }
 
   template<typename T>
-  auto& writeUInt64(T value)
+  std::size_t writeUInt64(T value)
   {
     return write<std::uint64_t>(value);
   }
 
-  auto& writeByte(std::byte value)
+  std::size_t writeByte(std::byte value)
   {
     return write<std::uint8_t>(std::to_integer<uint8_t>(value));
   }
+
+  // Fills in a value written earlier as a placeholder at offset.
+  template<typename T>
+  void overwriteUInt32(std::size_t offset, T value)
+  {
+    store<std::uint32_t>(offset, value);
+  }
   
 private:
   template<typename C, typename T>
-  C& write(T value)
+  std::size_t write(T value)
+  {
+    auto offset = offset_;
+
+    store<C>(offset, value);
+    offset_ += sizeof(C);
+
+    return offset;
+  }
+
+  template<typename C, typename T>
+  void store(std::size_t offset, T value)
   {
     static_assert(
       std::numeric_limits<T>::is_integer &&
       std::numeric_limits<C>::is_integer
     );
 
-    if(offset_ + sizeof(C) > size_)
+    if(offset + sizeof(C) > size_)
       throw std::out_of_range("Buffer overflow");
 
+    // Values are packed without padding, memcpy keeps unaligned stores legal.
     auto castValue = static_cast<C>(value);
-    auto& destination = *reinterpret_cast<C*>(buffer_ + offset_);
-
-    destination = castValue;
-    offset_ += sizeof(C);
 
-    return destination;
+    std::memcpy(buffer_ + offset, &castValue, sizeof(C));
   }
 
   std::byte* buffer_ = nullptr;
@@ -221,11 +236,12 @@ private:
     if(offset_ + sizeof(T) > size_)
       throw std::out_of_range("Buffer overflow");
 
-    auto valuePtr = reinterpret_cast<const T*>(buffer_ + offset_);
+    T value;
 
+    std::memcpy(&value, buffer_ + offset_, sizeof(T));
     offset_ += sizeof(T);
 
-    return *valuePtr;
+    return value;
   }
 
   const std::byte* buffer_ = nullptr;
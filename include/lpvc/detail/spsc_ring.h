@@ -0,0 +1,88 @@
+#ifndef LIBLPVC_DETAIL_SPSC_RING_H
+#define LIBLPVC_DETAIL_SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+
+namespace lpvc
+{
+
+
+// ===========================================================================
+//  SPSCRing
+// ===========================================================================
+
+// Lock-free ring of preallocated items for exactly one producer thread and
+// one consumer thread. Producer fills back() and publishes it with push(),
+// consumer reads front() and releases it with pop(). Items are never moved,
+// so they may own buffers which get reused.
+
+template<typename T>
+class SPSCRing final
+{
+public:
+  explicit SPSCRing(std::size_t capacity, const T& value = {}) :
+    items_(capacity, value)
+  {
+  }
+
+  std::size_t capacity() const noexcept
+  {
+    return items_.size();
+  }
+
+  // Producer only. Returns nullptr if the ring is full.
+  T* back() noexcept
+  {
+    auto tail = tail_.load(std::memory_order_relaxed);
+
+    if(tail - head_.load(std::memory_order_acquire) == items_.size())
+      return nullptr;
+
+    return &items_[tail % items_.size()];
+  }
+
+  // Producer only.
+  void push() noexcept
+  {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Consumer only. Returns nullptr if the ring is empty.
+  T* front() noexcept
+  {
+    auto head = head_.load(std::memory_order_relaxed);
+
+    if(head == tail_.load(std::memory_order_acquire))
+      return nullptr;
+
+    return &items_[head % items_.size()];
+  }
+
+  // Consumer only.
+  void pop() noexcept
+  {
+    head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  bool empty() const noexcept
+  {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+
+private:
+  std::vector<T> items_;
+
+  // Counters only grow, kept on separate cache lines as each is written by
+  // a different thread.
+  alignas(64) std::atomic<std::size_t> head_ { 0 };
+  alignas(64) std::atomic<std::size_t> tail_ { 0 };
+};
+
+
+} // namespace lpvc
+
+
+#endif // LIBLPVC_DETAIL_SPSC_RING_H
@@ -0,0 +1,48 @@
+#ifndef LIBLPVC_DETAIL_STOPWATCH_H
+#define LIBLPVC_DETAIL_STOPWATCH_H
+
+#include <chrono>
+#include <cstdint>
+
+
+namespace lpvc
+{
+
+
+// ===========================================================================
+//  Stopwatch
+// ===========================================================================
+
+// Measures time elapsed since construction in nanoseconds. Disabled
+// stopwatch never reads the clock and always reports 0.
+
+class Stopwatch final
+{
+public:
+  explicit Stopwatch(bool enabled = true) noexcept :
+    enabled_(enabled)
+  {
+    if(enabled_)
+      start_ = Clock::now();
+  }
+
+  std::uint64_t elapsed() const noexcept
+  {
+    if(!enabled_)
+      return 0;
+
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count();
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  Clock::time_point start_;
+  bool enabled_;
+};
+
+
+} // namespace lpvc
+
+
+#endif // LIBLPVC_DETAIL_STOPWATCH_H
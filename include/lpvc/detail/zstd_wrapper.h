@@ -39,6 +39,36 @@ struct ZSTDDCtxDeleter final
 using ZSTDDCtx = std::unique_ptr<ZSTD_DCtx, ZSTDDCtxDeleter>;
 
 
+// ===========================================================================
+//  ZSTDCDictDeleter
+// ===========================================================================
+
+struct ZSTDCDictDeleter final
+{
+  void operator()(ZSTD_CDict* dict) const noexcept
+  {
+    ZSTD_freeCDict(dict);
+  }
+};
+
+using ZSTDCDict = std::unique_ptr<ZSTD_CDict, ZSTDCDictDeleter>;
+
+
+// ===========================================================================
+//  ZSTDDDictDeleter
+// ===========================================================================
+
+struct ZSTDDDictDeleter final
+{
+  void operator()(ZSTD_DDict* dict) const noexcept
+  {
+    ZSTD_freeDDict(dict);
+  }
+};
+
+using ZSTDDDict = std::unique_ptr<ZSTD_DDict, ZSTDDDictDeleter>;
+
+
 } // namespace lpvc
 
 
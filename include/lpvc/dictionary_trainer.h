@@ -0,0 +1,46 @@
+#ifndef LIBLPVC_DICTIONARY_TRAINER_H
+#define LIBLPVC_DICTIONARY_TRAINER_H
+
+#include <lpvc/lpvc.h>
+#include <cstddef>
+#include <vector>
+
+
+namespace lpvc
+{
+
+
+// ===========================================================================
+//  DictionaryTrainer
+// ===========================================================================
+
+// Trains a dictionary on block data of already encoded frames. Frames must be
+// added in stream order, starting with a key frame. Streams encoded with
+// different settings of the same content make good training material.
+
+class DictionaryTrainer final
+{
+public:
+  static constexpr std::size_t defaultDictionarySize = 112 * 1024;
+
+  DictionaryTrainer(const BitmapInfo& bitmapInfo);
+
+  void addFrame(const std::byte* inputBuffer, std::size_t inputBufferSize);
+  Dictionary train(std::size_t maxDictionarySize = defaultDictionarySize) const;
+
+private:
+  void addSample(const std::byte* sample, std::size_t sampleSize);
+
+  Decoder decoder_;
+  std::vector<Color> bitmap_;
+  std::vector<std::byte> samples_;
+  std::vector<std::size_t> sampleSizes_;
+
+  friend class Decoder;
+};
+
+
+} // namespace lpvc
+
+
+#endif // LIBLPVC_DICTIONARY_TRAINER_H
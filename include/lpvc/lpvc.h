@@ -1,13 +1,18 @@
 #ifndef LIBLPVC_LPVC_H
 #define LIBLPVC_LPVC_H
 
+#include <lpvc/detail/bit_packing.h>
+#include <lpvc/detail/color_planes.h>
+#include <lpvc/detail/color_table.h>
 #include <lpvc/detail/serialization.h>
+#include <lpvc/detail/stopwatch.h>
 #include <lpvc/detail/variant_utils.h>
 #include <lpvc/detail/zstd_wrapper.h>
 #include <array>
 #include <cstddef>
+#include <memory>
 #include <optional>
-#include <unordered_map>
+#include <type_traits>
 #include <variant>
 #include <vector>
 
@@ -22,6 +27,8 @@ namespace lpvc
 
 class Encoder;
 class Decoder;
+class DictionaryTrainer;
+class ContainerReader;
 
 
 // ===========================================================================
@@ -66,6 +73,29 @@ struct BitmapInfo final
 };
 
 
+// ===========================================================================
+//  PixelFormat
+// ===========================================================================
+
+// Byte order of pixels in memory. X and A bytes are ignored on input and set
+// to 255 on output, frames carry no alpha. RGB565 pixels are little endian
+// 16-bit words, red in the most significant bits.
+
+enum class PixelFormat
+{
+  RGB24,
+  BGR24,
+  RGBX32,
+  BGRX32,
+  RGB565,
+  RGBA32,
+  BGRA32
+};
+
+
+std::size_t pixelSize(PixelFormat pixelFormat);
+
+
 // ===========================================================================
 //  Palette
 // ===========================================================================
@@ -98,15 +128,60 @@ public:
   
   std::size_t bits() const;
 
+  // Colors are kept sorted (see ColorOrdering), except in palettes ordered
+  // by PaletteOrderBlock. Both operations accept those, other palette has to
+  // be sorted. Results are sorted.
   Palette difference(const Palette& other) const;
   Palette merge(const Palette& other) const;
 
 private:
+  Palette sorted() const;
+
   std::array<Color, maxColorCount> colors_ {};
   std::size_t size_ = 0;
 };
 
 
+// Maps packed colors (see packColor) to their palette indices.
+using ColorMap = ColorTable<unsigned char, 2 * Palette::maxColorCount>;
+
+
+// ===========================================================================
+//  PaletteCache
+// ===========================================================================
+
+// Palettes dropped by PaletteResetBlock, kept along with their color maps.
+// Encoder and Decoder maintain identical caches, so PaletteRecallBlock can
+// bring a palette back by its slot. Slots are filled in round-robin order.
+// Key frames clear the cache.
+
+class PaletteCache final
+{
+public:
+  static constexpr std::size_t slotCount = 8;
+
+  const Palette& palette(std::size_t slot) const noexcept;
+
+  // Moves palette and its color map to the next slot, leaving both empty.
+  void store(Palette& palette, ColorMap& colorMap);
+
+  // Exchanges palette and its color map with the ones in given slot.
+  void swap(std::size_t slot, Palette& palette, ColorMap& colorMap);
+
+  void clear() noexcept;
+
+private:
+  struct Entry
+  {
+    Palette palette;
+    ColorMap colorMap;
+  };
+
+  std::array<Entry, slotCount> entries_;
+  std::size_t nextSlot_ = 0;
+};
+
+
 // ===========================================================================
 //  FrameBlock
 // ===========================================================================
@@ -118,6 +193,15 @@ struct IndexedBitmapBlock;
 struct RawBitmapBlock;
 struct SolidColorBitmapBlock;
 struct NullBitmapBlock;
+struct IndexedResidualBitmapBlock;
+struct DirtyTilesBlock;
+struct ScrollBlock;
+struct PaletteRecallBlock;
+struct PaletteOrderBlock;
+struct WidePaletteBlock;
+struct WideIndexedBitmapBlock;
+struct FilteredRawBitmapBlock;
+struct PlanarRawBitmapBlock;
 
 // NOTE: Order of block types within FrameBlock does matter!
 // Do not remove block types. When adding a new block type, add it at the end
@@ -130,7 +214,16 @@ using FrameBlock = std::variant<
   IndexedBitmapBlock,
   RawBitmapBlock,
   SolidColorBitmapBlock,
-  NullBitmapBlock
+  NullBitmapBlock,
+  IndexedResidualBitmapBlock,
+  DirtyTilesBlock,
+  ScrollBlock,
+  PaletteRecallBlock,
+  PaletteOrderBlock,
+  WidePaletteBlock,
+  WideIndexedBitmapBlock,
+  FilteredRawBitmapBlock,
+  PlanarRawBitmapBlock
 >;
 
 
@@ -225,6 +318,241 @@ struct NullBitmapBlock final
 };
 
 
+// ===========================================================================
+//  IndexedResidualBitmapBlock
+// ===========================================================================
+
+// Same layout as IndexedBitmapBlock, but each index is XOR-ed with the index
+// of the pixel at the same position in the previous frame. Unchanged pixels
+// become zeros. Every color of the previous frame has to be present in the
+// current palette.
+
+struct IndexedResidualBitmapBlock final
+{
+  static std::size_t maxSize(const BitmapInfo& bitmapInfo) noexcept;
+
+  void encode(Encoder& encoder, BufferWriter& bufferWriter);
+  void decode(Decoder& decoder, BufferReader& bufferReader);
+};
+
+
+// ===========================================================================
+//  DirtyTilesBlock
+// ===========================================================================
+
+// Lists tiles which changed since the previous frame as alternating runs of
+// clean and dirty tiles. Bitmap block following it codes only pixels of
+// those tiles - tile after tile, row by row within a tile. Remaining tiles
+// are copied from the previous frame.
+
+struct DirtyTilesBlock final
+{
+  static constexpr std::size_t maxRunLength = 0xFFFF;
+
+  static std::size_t maxSize(const BitmapInfo& bitmapInfo) noexcept;
+
+  void encode(Encoder& encoder, BufferWriter& bufferWriter);
+  void decode(Decoder& decoder, BufferReader& bufferReader);
+};
+
+
+// ===========================================================================
+//  ScrollBlock
+// ===========================================================================
+
+// Shifts the previous frame by (x, y) pixels. Pixels uncovered by the shift
+// are coded by the block itself, row by row. Blocks following it treat the
+// shifted frame as the previous frame, when nothing else changed they're
+// omitted.
+
+struct ScrollBlock final
+{
+  static std::size_t maxSize(const BitmapInfo& bitmapInfo) noexcept;
+
+  void encode(Encoder& encoder, BufferWriter& bufferWriter, int x, int y);
+  void decode(Decoder& decoder, BufferReader& bufferReader);
+};
+
+
+// ===========================================================================
+//  PaletteRecallBlock
+// ===========================================================================
+
+// Exchanges the current palette with the one in given PaletteCache slot.
+// Palette blocks following it may extend the recalled palette.
+
+struct PaletteRecallBlock final
+{
+  static std::size_t maxSize() noexcept;
+
+  void encode(Encoder& encoder, BufferWriter& bufferWriter, std::size_t slot);
+  void decode(Decoder& decoder, BufferReader& bufferReader);
+};
+
+
+// ===========================================================================
+//  PaletteOrderBlock
+// ===========================================================================
+
+// Alternative to PaletteBlock. Colors are appended after the existing ones
+// in the order they're listed, instead of being merged in sorted order, so
+// existing colors keep their indices as the palette grows. Colors are stored
+// uncompressed - a separate zstd flush this small would gain little and with
+// zstd workers it would also cut compression history short.
+
+struct PaletteOrderBlock final
+{
+  static std::size_t maxSize() noexcept;
+
+  void encode(Encoder& encoder, BufferWriter& bufferWriter, const Palette& palette);
+  void decode(Decoder& decoder, BufferReader& bufferReader);
+};
+
+
+// ===========================================================================
+//  WidePaletteBlock
+// ===========================================================================
+
+// Palette of WideIndexedBitmapBlock, for frames with more colors than
+// Palette holds. It's kept apart from the regular palette, which stays
+// intact for the indexed frames that follow. Colors are appended after the
+// existing ones in the order they're listed, or replace them all when the
+// reset flag is set. Colors are stored uncompressed (see PaletteOrderBlock).
+
+struct WidePaletteBlock final
+{
+  static constexpr std::size_t maxColorCount = 4096;
+
+  static std::size_t maxSize() noexcept;
+
+  void encode(Encoder& encoder, BufferWriter& bufferWriter, const std::vector<Color>& colors, bool reset);
+  void decode(Decoder& decoder, BufferReader& bufferReader);
+};
+
+
+// Maps packed colors to their wide palette indices.
+using WideColorMap = ColorTable<std::uint16_t, 2 * WidePaletteBlock::maxColorCount>;
+
+
+// ===========================================================================
+//  WideIndexedBitmapBlock
+// ===========================================================================
+
+// Bitmap of 16-bit wide palette indices, stored as two byte planes - low
+// bytes of all indices followed by their high bytes. Indices aren't bit
+// packed, zstd finds longer matches in whole bytes and the high byte plane
+// compresses to almost nothing.
+
+struct WideIndexedBitmapBlock final
+{
+  static std::size_t maxSize(const BitmapInfo& bitmapInfo) noexcept;
+
+  void encode(Encoder& encoder, BufferWriter& bufferWriter);
+  void decode(Decoder& decoder, BufferReader& bufferReader);
+};
+
+
+// ===========================================================================
+//  FilteredRawBitmapBlock
+// ===========================================================================
+
+// Full frame RawBitmapBlock with PNG-style prediction. Every row starts with
+// a filter byte, followed by differences (modulo 256) between color bytes
+// and their predictions. Filters predict each byte from the same color
+// component of:
+//   0 None            nothing (prediction is 0)
+//   1 Sub             left pixel
+//   2 Up              pixel above
+//   3 Average         average of left pixel and pixel above
+//   4 Paeth           left pixel, pixel above or above left, see PNG
+//   5 PreviousFrame   same pixel of the previous frame
+// Missing left pixels count as 0. First row can't use filters 2 - 4.
+
+struct FilteredRawBitmapBlock final
+{
+  static std::size_t maxSize(const BitmapInfo& bitmapInfo) noexcept;
+
+  void encode(Encoder& encoder, BufferWriter& bufferWriter);
+  void decode(Decoder& decoder, BufferReader& bufferReader);
+};
+
+
+// ===========================================================================
+//  PlanarRawBitmapBlock
+// ===========================================================================
+
+// RawBitmapBlock with red, green and blue bytes of all pixels stored as
+// three separate planes. Smooth content (gradients, photos) compresses
+// better this way, flat content with runs of whole colors compresses worse.
+
+struct PlanarRawBitmapBlock final
+{
+  static std::size_t maxSize(const BitmapInfo& bitmapInfo) noexcept;
+
+  void encode(Encoder& encoder, BufferWriter& bufferWriter);
+  void decode(Decoder& decoder, BufferReader& bufferReader);
+};
+
+
+// ===========================================================================
+//  Dictionary
+// ===========================================================================
+
+// Trained zstd dictionary (see DictionaryTrainer). It primes compression
+// history at the start of a stream and after every key frame. Decoder must
+// use the same dictionary as the encoder.
+
+class Dictionary final
+{
+public:
+  Dictionary(const std::byte* data, std::size_t size);
+
+  const std::byte* data() const noexcept;
+  std::size_t size() const noexcept;
+
+private:
+  std::vector<std::byte> data_;
+  ZSTDDDict zstdDDict_;
+
+  friend class Decoder;
+};
+
+
+// ===========================================================================
+//  FrameStats
+// ===========================================================================
+
+// Statistics of a single frame or accumulated over many frames, collected by
+// Encoder and Decoder once enabled. Block counts and sizes are indexed by
+// block id (index within FrameBlock), sizes include block id byte. Palette
+// resets are counted as PaletteResetBlock. Times are in nanoseconds.
+
+struct FrameStats final
+{
+  static constexpr std::size_t blockTypeCount = std::variant_size_v<FrameBlock>;
+
+  std::size_t frameCount = 0;
+  std::size_t keyFrameCount = 0;
+  std::size_t size = 0;
+  std::array<std::size_t, blockTypeCount> blockCounts {};
+  std::array<std::size_t, blockTypeCount> blockSizes {};
+
+  // Palette in use after the (last) frame.
+  std::size_t paletteSize = 0;
+  std::size_t paletteBits = 0;
+
+  // Frame analysis (palette creation, change, scroll and dirty tile
+  // detection) is done by Encoder only. Packing covers everything blocks do
+  // besides zstd, e.g. palette index lookup and bit packing.
+  std::uint64_t analysisTime = 0;
+  std::uint64_t packingTime = 0;
+  std::uint64_t zstdTime = 0;
+  std::uint64_t totalTime = 0;
+
+  FrameStats& operator+=(const FrameStats& other) noexcept;
+};
+
+
 // ===========================================================================
 //  Encoder
 // ===========================================================================
@@ -237,6 +565,62 @@ struct EncoderSettings final
   bool usePalette = true;
   int zstdCompressionLevel = 18;
   int zstdWorkerCount = 1;
+
+  // Code nearly static indexed frames as IndexedResidualBitmapBlock whenever
+  // residuals compress smaller than whole indexed bitmaps. Which one does
+  // depends on the content and compression level, it's measured by trial
+  // compressions now and then.
+  bool useResidual = false;
+
+  // Code only tiles which changed since the previous frame (DirtyTilesBlock).
+  // Reduces compression time and decoder writes, but tiles compress slightly
+  // worse than whole rows.
+  bool useDirtyTiles = false;
+
+  // Maximum distance in pixels (per axis) at which scrolling is detected.
+  // Scroll detection is disabled when set to 0.
+  int scrollSearchRadius = 0;
+
+  // Optional trained dictionary, can be shared between encoders.
+  std::shared_ptr<const Dictionary> dictionary = nullptr;
+
+  // Encoding time budget per frame in microseconds, 0 disables it. Starting
+  // from level 1, compression level is then adjusted after every frame to
+  // the highest one (up to zstdCompressionLevel) keeping frames within the
+  // budget. Requires zstd workers (zstdWorkerCount above 0), without them a
+  // new level would take effect on the next key frame only. AsyncEncoder
+  // counts compression time only, analysis of the next frame overlaps it.
+  int frameTimeBudget = 0;
+
+  // Automatic key frames, disabled when maxKeyFrameInterval is 0. Key frame
+  // is placed once maxKeyFrameInterval frames passed since the last one, or
+  // at a scene change once minKeyFrameInterval frames did. Key frames
+  // requested by the caller are placed as well.
+  int minKeyFrameInterval = 0;
+  int maxKeyFrameInterval = 0;
+
+  // Recall palettes dropped earlier (PaletteRecallBlock) instead of sending
+  // them again, e.g. when the scene keeps switching back and forth.
+  bool usePaletteCache = false;
+
+  // Keep palette indices stable as the palette grows and give new colors
+  // indices by their frequency (PaletteOrderBlock), so that indexed bitmaps
+  // of consecutive frames match better.
+  bool useOrderedPalette = false;
+
+  // Code frames with more colors than a palette holds, up to
+  // WidePaletteBlock::maxColorCount, as WideIndexedBitmapBlock instead of
+  // RawBitmapBlock.
+  bool useWidePalette = false;
+
+  // Code raw frames as FilteredRawBitmapBlock, which turns gradients and
+  // dithering into small residuals that compress better and faster. Frames
+  // coded as dirty tiles stay unfiltered.
+  bool useRawFilters = false;
+
+  // Code raw frames with few runs of the same color as PlanarRawBitmapBlock.
+  // Filtered raw frames (see useRawFilters) take precedence.
+  bool usePlanarRaw = false;
 };
 
 
@@ -256,31 +640,209 @@ public:
   template<typename BitmapIterator>
   EncodeResult encode(BitmapIterator bitmapIterator, std::byte* outputBuffer, bool keyFrame);
 
+  // Encodes bitmap of given pixel format, converted while it's read. Rows
+  // start pitch bytes apart, bitmap points to the top one. Bottom-up
+  // bitmaps have negative pitch.
+  EncodeResult encode(const std::byte* bitmap, std::ptrdiff_t pitch, PixelFormat pixelFormat, std::byte* outputBuffer, bool keyFrame);
+
+  // Statistics are collected only while enabled. Frame statistics describe
+  // the last frame, totals accumulate until reset.
+  void enableStats(bool enabled) noexcept;
+  void resetStats() noexcept;
+  const FrameStats& frameStats() const noexcept;
+  const FrameStats& totalStats() const noexcept;
+
+  // Current zstd compression level, changes only with frameTimeBudget set.
+  int compressionLevel() const noexcept;
+
+  // Builds palette of the bitmap the same way as frame analysis does, without
+  // encoding anything. Returns nothing if the bitmap has too many colors.
+  // Meant for benchmarks and tests.
+  std::optional<Palette> analyzePalette(const Color* bitmap);
+
 private:
-  template<typename Block, typename ...Args>
-  void writeBlock(BufferWriter& bufferWriter, Args&& ...args);
+  // Residual bitmap is considered only if at most 1 / residualPixelRatio of
+  // all pixels changed since the previous frame. Such frames are coded the
+  // way that won the last trial, trials are repeated on every
+  // residualTrialInterval-th of them and on palette changes (see
+  // residualWins()).
+  static constexpr std::size_t residualPixelRatio = 64;
+  static constexpr std::size_t residualTrialInterval = 64;
+
+  // Dirty tiles are used only if at most 1 / dirtyTileRatio of all tiles
+  // changed since the previous frame.
+  static constexpr std::size_t dirtyTileSize = 8;
+  static constexpr std::size_t dirtyTileRatio = 8;
+
+  // Scroll is used only if it reduces the number of pixels to code (changed
+  // and exposed ones) at least scrollPixelRatio times.
+  static constexpr std::size_t scrollPixelRatio = 2;
+
+  // Filter of raw frames is picked by trying all of them on every
+  // rawFilterSampleStep-th row.
+  static constexpr std::size_t rawFilterSampleStep = 8;
+
+  // Raw frames are coded as planes if fewer than 1 / planarRawRunRatio of
+  // pixels repeat their left neighbour, counted on every
+  // planarRawSampleStep-th row.
+  static constexpr std::size_t planarRawRunRatio = 2;
+  static constexpr std::size_t planarRawSampleStep = 8;
+
+  // After a frame exceeds the time budget, compression level isn't raised
+  // for a number of frames. The number doubles each time raised level fails
+  // right away (see adjustCompressionLevel).
+  static constexpr int minAdaptiveCompressionLevel = 1;
+  static constexpr std::size_t minLevelHoldLength = 8;
+  static constexpr std::size_t maxLevelHoldLength = 512;
+
+  // Window used by high levels (8 MB), adaptive level starts from low ones.
+  static constexpr int adaptiveWindowLog = 23;
+
+  // Scene changes when at least 1 / sceneChangePixelRatio of all pixels
+  // changed and, for indexed frames, at least 1 / sceneChangeColorRatio of
+  // palette colors are new.
+  static constexpr std::size_t sceneChangePixelRatio = 2;
+  static constexpr std::size_t sceneChangeColorRatio = 2;
+
+  struct FrameAnalysis
+  {
+    bool nullFrame = false;
+    std::optional<Palette> palette;
+    std::size_t changedPixelCount = 0;
+  };
+
+  struct FrameType
+  {
+    bool keyFrame = false;
+    bool nullFrame = false;
+  };
+
+  // Frame written by packFrame(), with payloads of its blocks left
+  // uncompressed and cut out of the block data. Each payload goes where
+  // compressBuffer() would have put it.
+  struct PackedFrame
+  {
+    struct Payload
+    {
+      std::size_t blockOffset = 0;
+      std::size_t size = 0;
+    };
+
+    std::vector<std::byte> blocks;
+    std::size_t blocksSize = 0;
+    std::vector<std::byte> payloadData;
+    std::vector<Payload> payloads;
+    FrameType frameType;
+    bool resetStream = false; // Key frame reset is left to compressFrame().
+    int compressionLevel = 0;
+    std::uint64_t compressionTime = 0; // Set by compressFrame(), 0 before.
+  };
+
+  struct Scroll
+  {
+    int x = 0;
+    int y = 0;
+    std::size_t changedPixelCount = 0; // Exposed pixels excluded.
+    std::size_t exposedPixelCount = 0;
+  };
+
+  // Pixel format is a template parameter, so that encode() picks the
+  // conversion once per frame rather than for every row.
+  template<PixelFormat Format>
+  struct FormattedBitmap
+  {
+    const std::byte* data;
+    std::ptrdiff_t pitch;
+  };
 
   template<typename BitmapIterator>
-  void copyFrameBitmap(BitmapIterator bitmapIterator);
+  struct IsFormattedBitmap : std::false_type {};
+
+  template<PixelFormat Format>
+  struct IsFormattedBitmap<FormattedBitmap<Format>> : std::true_type {};
 
   template<typename BitmapIterator>
-  std::optional<Palette> makePalette(BitmapIterator bitmapIterator);
+  FrameType writeFrame(BitmapIterator bitmapIterator, BufferWriter& bufferWriter, bool keyFrame);
+
+  // Encoding split into two stages for AsyncEncoder. packFrame() does all
+  // but compression, which compressFrame() does in order of packing. Only
+  // compressFrame() touches the zstd stream, so a frame may be packed while
+  // the previous one is compressed.
+  void packFrame(const Color* bitmap, bool keyFrame, PackedFrame& packedFrame);
+  EncodeResult compressFrame(PackedFrame& packedFrame, std::byte* outputBuffer);
+
+  template<typename Block, typename ...Args>
+  void writeBlock(BufferWriter& bufferWriter, Args&& ...args);
+
+  template<typename BitmapIterator>
+  FrameAnalysis analyzeFrame(BitmapIterator bitmapIterator);
+
+  template<PixelFormat Format>
+  void readFormattedBitmap(const FormattedBitmap<Format>& bitmap, std::size_t offset, std::size_t count, Color* destination) const;
+
+  bool addPaletteColors(const Color* begin, const Color* end);
+  Palette makePalette() const;
+  bool isSceneChange(const FrameAnalysis& frameAnalysis) const;
+  bool residualWins(bool paletteChanged);
+  std::size_t findDirtyTiles();
+  std::optional<Scroll> findScroll();
+  Palette orderColors(const Palette& colors) const;
+  void writePaletteColors(BufferWriter& bufferWriter, const Palette& colors);
+  std::optional<std::size_t> findCachedPalette(const Palette& newPalette) const;
+  bool makeWidePalette();
+  bool prefersPlanarRaw() const;
+  std::size_t countChangedPixels(int scrollX, int scrollY) const;
+  const std::vector<Color>& blockBitmap() const noexcept;
 
   void updatePalette(BufferWriter& bufferWriter, const Palette& newPalette);
+  void updateWidePalette(BufferWriter& bufferWriter);
   void compressBuffer(BufferWriter& bufferWriter, const std::byte* inputBuffer, std::size_t inputBufferSize);
+  void compressStream(BufferWriter& bufferWriter, const std::byte* inputBuffer, std::size_t inputBufferSize);
 
   void resetPalette();
   void reset();
+  void updateStats(std::size_t frameSize, bool keyFrame, std::uint64_t totalTime);
+  void adjustCompressionLevel(std::uint64_t frameTime);
+  void applyCompressionLevel(int level);
 
   EncoderSettings settings_;
   BitmapInfo bitmapInfo_;
   std::vector<Color> frameBitmap_;
   std::vector<Color> previousFrameBitmap_;
+  std::vector<Color> tileBitmap_;
+  std::vector<unsigned char> dirtyTiles_;
+  std::vector<Color> scrolledFrameBitmap_;
+  std::vector<std::uint32_t> rowProjections_[2];
+  std::vector<std::uint32_t> columnProjections_[2];
   std::vector<std::byte> internalBuffer_;
   Palette palette_;
-  std::unordered_map<Color, unsigned char, ColorHash> colorMap_;
+  ColorMap colorMap_;
+  PaletteCache paletteCache_;
+  ColorTable<std::uint32_t, 4 * Palette::maxColorCount> paletteBuilder_; // Counts runs of each color.
+  WideColorMap wideColorMap_;
+  WideColorMap widePaletteBuilder_; // Values are unused.
   bool firstFrame_ = true;
+  bool previousFrameValid_ = false;
+  bool previousFrameInPalette_ = false;
+  bool previousProjectionsValid_ = false; // See findScroll().
+  std::size_t keyFrameDistance_ = 0; // Frames since the last key frame.
+  bool residualPreferred_ = false;
+  std::size_t residualTrialCountdown_ = 0;
+  bool trialCompression_ = false; // See compressBuffer().
+  PackedFrame* packedFrame_ = nullptr; // Set while packFrame() runs.
+  std::vector<std::byte> trialBuffer_;
+  std::vector<std::byte> streamHistory_; // Recent input of zstdCompressor_.
+  ZSTDCCtx zstdTrialCompressor_;
+  ZSTDCDict zstdDictionary_;
   ZSTDCCtx zstdCompressor_;
+  bool statsEnabled_ = false;
+  FrameStats frameStats_;
+  FrameStats totalStats_;
+  int compressionLevel_ = 0;
+  int streamCompressionLevel_ = 0; // Level of zstdCompressor_, see applyCompressionLevel().
+  bool compressionLevelRaised_ = false;
+  std::size_t levelHoldLength_ = minLevelHoldLength;
+  std::size_t levelHoldFrameCount_ = 0;
 
   friend struct KeyFrameBlock;
   friend struct PaletteBlock;
@@ -289,6 +851,16 @@ private:
   friend struct RawBitmapBlock;
   friend struct SolidColorBitmapBlock;
   friend struct NullBitmapBlock;
+  friend struct IndexedResidualBitmapBlock;
+  friend struct DirtyTilesBlock;
+  friend struct ScrollBlock;
+  friend struct PaletteRecallBlock;
+  friend struct PaletteOrderBlock;
+  friend struct WidePaletteBlock;
+  friend struct WideIndexedBitmapBlock;
+  friend struct FilteredRawBitmapBlock;
+  friend struct PlanarRawBitmapBlock;
+  friend class AsyncEncoder;
 };
 
 
@@ -302,26 +874,97 @@ public:
   struct DecodeResult
   {
     bool keyFrame = false;
+    bool nullFrame = false;
   };
 
-  Decoder(const BitmapInfo& bitmapInfo);
+  Decoder(const BitmapInfo& bitmapInfo, std::shared_ptr<const Dictionary> dictionary = {});
 
   template<typename BitmapIterator>
   DecodeResult decode(const std::byte* inputBuffer, std::size_t inputBufferSize, BitmapIterator bitmapIterator);
 
+  // Decodes straight into bitmap, which then becomes the reference for the
+  // next frame, so no full frame copies are made. Next frame may be decoded
+  // into the same bitmap again or into another one (e.g. a ring of buffers).
+  // Bitmap holding the last decoded frame must stay intact until the next
+  // frame is decoded.
+  DecodeResult decodeInPlace(const std::byte* inputBuffer, std::size_t inputBufferSize, Color* bitmap);
+
+  // Decodes into a bitmap of given pixel format. Rows are pitch bytes apart,
+  // bitmap pointing at the top one, so negative pitch stores them bottom-up.
+  // Full frame bitmap blocks are converted while being decoded, other frames
+  // are converted from the decoded frame afterwards.
+  DecodeResult decode(const std::byte* inputBuffer, std::size_t inputBufferSize, std::byte* bitmap, std::ptrdiff_t pitch, PixelFormat pixelFormat);
+
+  // Decodes given frame of the container. Decoding starts from the nearest
+  // preceding key frame, or continues from the frame decoded by the previous
+  // seek() if it lies in between.
+  template<typename BitmapIterator>
+  DecodeResult seek(const ContainerReader& containerReader, std::size_t frameIndex, BitmapIterator bitmapIterator);
+
+  // See Encoder::enableStats(). Analysis time is always 0.
+  void enableStats(bool enabled) noexcept;
+  void resetStats() noexcept;
+  const FrameStats& frameStats() const noexcept;
+  const FrameStats& totalStats() const noexcept;
+
 private:
+  struct BitmapSpan
+  {
+    Color* data;
+    std::size_t size;
+  };
+
+  struct FormattedBitmap
+  {
+    std::byte* data;
+    std::ptrdiff_t pitch;
+    PixelFormat pixelFormat;
+  };
+
+  void decodeFrame(const std::byte* inputBuffer, std::size_t inputBufferSize, Color* bitmap, const FormattedBitmap& outputBitmap = {});
+  std::size_t seekStart(const ContainerReader& containerReader, std::size_t frameIndex) const;
   void decompressBuffer(BufferReader& bufferReader, std::byte* outputBuffer, std::size_t outputBufferSize);
 
+  std::size_t pixelCount() const noexcept;
+  Color* ownedBitmap();
+  bool ownsBitmap(const Color* bitmap) const noexcept;
+  BitmapSpan blockBitmap() noexcept;
+  void applyDirtyTiles();
+
+  bool writesOutputBitmap() const noexcept;
+  void writeOutputBitmap(const Color* bitmap, std::size_t offset, std::size_t count);
+  void writeOutputBitmap(const std::uint8_t* paletteIndices, const std::byte* formattedPalette, std::size_t offset, std::size_t count);
+  void fillOutputBitmap(const Color& color);
+
   void resetPalette();
   void reset();
+  void updateStats(std::size_t frameSize, std::uint64_t totalTime);
 
   BitmapInfo bitmapInfo_;
-  std::vector<Color> frameBitmap_;
-  std::vector<Color> previousFrameBitmap_;
+  std::vector<Color> ownedBitmaps_[2]; // Used by decode() only, allocated on first use.
+  Color* frame_ = nullptr;
+  Color* previousFrame_ = nullptr;
+  std::vector<Color> tileBitmap_;
+  std::vector<unsigned char> dirtyTiles_;
+  std::size_t dirtyTileWidth_ = 0;
+  std::size_t dirtyTileHeight_ = 0;
   std::vector<std::byte> internalBuffer_;
   Palette palette_;
+  ColorMap colorMap_;
+  PaletteCache paletteCache_;
+  std::vector<Color> widePalette_;
+  std::shared_ptr<const Dictionary> dictionary_;
   ZSTDDCtx zstdDecompressor_;
+  DictionaryTrainer* dictionaryTrainer_ = nullptr;
+  std::uint64_t seekContainerId_ = 0; // See ContainerReader::id_, 0 when the last frame wasn't decoded by seek().
+  std::size_t seekFrameIndex_ = 0;
   DecodeResult result_;
+  bool frameScrolled_ = false;
+  FormattedBitmap outputBitmap_ {}; // Set by decode() with pixel format for one frame only.
+  bool outputBitmapWritten_ = false;
+  bool statsEnabled_ = false;
+  FrameStats frameStats_;
+  FrameStats totalStats_;
 
   friend struct KeyFrameBlock;
   friend struct PaletteBlock;
@@ -330,6 +973,16 @@ private:
   friend struct RawBitmapBlock;
   friend struct SolidColorBitmapBlock;
   friend struct NullBitmapBlock;
+  friend struct IndexedResidualBitmapBlock;
+  friend struct DirtyTilesBlock;
+  friend struct ScrollBlock;
+  friend struct PaletteRecallBlock;
+  friend struct PaletteOrderBlock;
+  friend struct WidePaletteBlock;
+  friend struct WideIndexedBitmapBlock;
+  friend struct FilteredRawBitmapBlock;
+  friend struct PlanarRawBitmapBlock;
+  friend class DictionaryTrainer;
 };
 
 
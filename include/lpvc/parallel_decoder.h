@@ -0,0 +1,82 @@
+#ifndef LIBLPVC_PARALLEL_DECODER_H
+#define LIBLPVC_PARALLEL_DECODER_H
+
+#include <lpvc/lpvc.h>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace lpvc
+{
+
+
+// ===========================================================================
+//  ParallelDecoder
+// ===========================================================================
+
+// Decodes segments of frames starting with a key frame concurrently, each
+// worker thread with its own Decoder. Key frames must be flagged by the
+// caller (e.g. from the encoder's EncodeResult). Decoded frames are passed to
+// the callback in order, on the thread calling decode() or flush(). Bitmap
+// passed to the callback is valid during the call only. Frames not flushed
+// are discarded on destruction.
+
+class ParallelDecoder final
+{
+public:
+  using OutputCallback = std::function<void(const Color* bitmap, const Decoder::DecodeResult& decodeResult)>;
+
+  // Thread count of 0 uses all hardware threads.
+  ParallelDecoder(const BitmapInfo& bitmapInfo,
+                  OutputCallback outputCallback,
+                  std::size_t threadCount = 0,
+                  std::shared_ptr<const Dictionary> dictionary = {});
+  ~ParallelDecoder();
+
+  ParallelDecoder(const ParallelDecoder&) = delete;
+  ParallelDecoder& operator=(const ParallelDecoder&) = delete;
+
+  // Key frame starts a new segment.
+  void decode(const std::byte* inputBuffer, std::size_t inputBufferSize, bool keyFrame);
+
+  // Decodes all pending frames and waits for their output.
+  void flush();
+
+private:
+  struct Segment;
+
+  // Decoded frames awaiting delivery, per segment. Workers wait once the
+  // buffers are full, which bounds memory use regardless of segment length.
+  static constexpr std::size_t segmentBufferedFrameCount = 8;
+
+  void submitSegment();
+  bool deliverSegment(bool wait);
+  void workerThread(Decoder& decoder);
+
+  BitmapInfo bitmapInfo_;
+  OutputCallback outputCallback_;
+  std::size_t maxPendingSegmentCount_;
+  std::unique_ptr<Segment> currentSegment_;
+  std::deque<std::unique_ptr<Segment>> pendingSegments_;
+  std::vector<std::unique_ptr<Segment>> freeSegments_;
+  std::vector<Decoder> decoders_;
+  std::mutex mutex_;
+  std::condition_variable segmentQueued_;
+  std::condition_variable frameDecoded_;
+  std::condition_variable frameDelivered_;
+  std::deque<Segment*> segmentQueue_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+
+} // namespace lpvc
+
+
+#endif // LIBLPVC_PARALLEL_DECODER_H
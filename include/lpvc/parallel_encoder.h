@@ -0,0 +1,86 @@
+#ifndef LIBLPVC_PARALLEL_ENCODER_H
+#define LIBLPVC_PARALLEL_ENCODER_H
+
+#include <lpvc/lpvc.h>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace lpvc
+{
+
+
+// ===========================================================================
+//  ParallelEncoder
+// ===========================================================================
+
+// Splits frames into segments starting with a key frame and encodes them
+// concurrently, each worker thread with its own Encoder. Output is identical
+// to a single Encoder given key frames at segment boundaries. Encoded frames
+// are passed to the callback in order, on the thread calling encode() or
+// flush(). Frames not flushed are discarded on destruction.
+
+class ParallelEncoder final
+{
+public:
+  using OutputCallback = std::function<void(const std::byte* frame, std::size_t frameSize, bool keyFrame)>;
+
+  static constexpr std::size_t defaultSegmentLength = 60;
+
+  // Thread count of 0 uses all hardware threads.
+  ParallelEncoder(const BitmapInfo& bitmapInfo,
+                  const EncoderSettings& settings,
+                  OutputCallback outputCallback,
+                  std::size_t threadCount = 0,
+                  std::size_t segmentLength = defaultSegmentLength);
+  ~ParallelEncoder();
+
+  ParallelEncoder(const ParallelEncoder&) = delete;
+  ParallelEncoder& operator=(const ParallelEncoder&) = delete;
+
+  // Key frame starts a new segment.
+  template<typename BitmapIterator>
+  void encode(BitmapIterator bitmapIterator, bool keyFrame = false);
+
+  // Encodes all pending frames and waits for their output.
+  void flush();
+
+private:
+  struct Segment;
+
+  Color* beginFrame(bool keyFrame);
+  void endFrame();
+  void submitSegment();
+  bool deliverSegment(bool wait);
+  void workerThread(Encoder& encoder);
+
+  BitmapInfo bitmapInfo_;
+  OutputCallback outputCallback_;
+  std::size_t segmentLength_;
+  std::size_t maxPendingSegmentCount_;
+  std::unique_ptr<Segment> currentSegment_;
+  std::deque<std::unique_ptr<Segment>> pendingSegments_;
+  std::vector<std::unique_ptr<Segment>> freeSegments_;
+  std::vector<Encoder> encoders_;
+  std::mutex mutex_;
+  std::condition_variable segmentQueued_;
+  std::condition_variable segmentEncoded_;
+  std::deque<Segment*> segmentQueue_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
+
+
+} // namespace lpvc
+
+
+#include <lpvc/detail/parallel_encoder_impl.h>
+
+
+#endif // LIBLPVC_PARALLEL_ENCODER_H
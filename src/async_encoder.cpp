@@ -0,0 +1,254 @@
+#include <lpvc/async_encoder.h>
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace lpvc
+{
+
+
+AsyncEncoder::AsyncEncoder(const BitmapInfo& bitmapInfo,
+                           const EncoderSettings& settings,
+                           OutputCallback outputCallback,
+                           std::size_t slotCount) :
+  pixelCount_(bitmapInfo.width * bitmapInfo.height),
+  encoder_(bitmapInfo, settings),
+  outputCallback_(std::move(outputCallback)),
+  frameRing_(std::max<std::size_t>(slotCount, 1), FrameSlot{ std::vector<Color>(pixelCount_) })
+{
+  analysisThread_ = std::thread(&AsyncEncoder::analysisThread, this);
+  compressionThread_ = std::thread(&AsyncEncoder::compressionThread, this);
+}
+
+
+AsyncEncoder::~AsyncEncoder()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+
+  frameSubmitted_.notify_one();
+  analysisThread_.join();
+  compressionThread_.join();
+}
+
+
+void AsyncEncoder::flush()
+{
+  producerWaiting_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    frameEncoded_.wait(lock, [this]() { return frameRing_.empty() && packedFrameCount_ == 0; });
+  }
+
+  producerWaiting_ = false;
+
+  rethrowError();
+}
+
+
+void AsyncEncoder::setError()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if(!error_)
+    error_ = std::current_exception();
+
+  failed_.store(true, std::memory_order_release);
+}
+
+
+void AsyncEncoder::rethrowError()
+{
+  if(!failed_.load(std::memory_order_acquire))
+    return;
+
+  std::exception_ptr error;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::swap(error, error_);
+    failed_ = false;
+  }
+
+  std::rethrow_exception(error);
+}
+
+
+AsyncEncoder::FrameSlot* AsyncEncoder::waitForSlot()
+{
+  rethrowError();
+
+  if(auto frameSlot = frameRing_.back())
+    return frameSlot;
+
+  FrameSlot* frameSlot = nullptr;
+
+  producerWaiting_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    frameEncoded_.wait(lock, [&]() { return (frameSlot = frameRing_.back()) != nullptr; });
+  }
+
+  producerWaiting_ = false;
+
+  return frameSlot;
+}
+
+
+void AsyncEncoder::submitFrame()
+{
+  frameRing_.push();
+
+  // Pairs with the fence in analysisThread(): either the worker sees the new
+  // frame or this thread sees it waiting. Mutex is taken only in the latter
+  // case, so the notification can't slip in before the worker waits.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  if(workerWaiting_.load(std::memory_order_relaxed))
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frameSubmitted_.notify_one();
+  }
+}
+
+
+void AsyncEncoder::analysisThread()
+{
+  std::size_t packedFrameIdx = 0;
+  auto forceKeyFrame = false;
+
+  while(true)
+  {
+    auto frameSlot = frameRing_.front();
+
+    if(!frameSlot)
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+
+      workerWaiting_.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+
+      frameSubmitted_.wait(lock, [&]() { return stopping_ || !frameRing_.empty(); });
+      workerWaiting_.store(false, std::memory_order_relaxed);
+
+      // Frames submitted before destruction are still encoded.
+      if(frameRing_.empty())
+        break;
+
+      continue;
+    }
+
+    // Packed frame is reused once the frame packed into it is compressed.
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      frameCompressed_.wait(lock, [this]() { return packedFrameCount_ < std::size(packedFrames_); });
+
+      forceKeyFrame = forceKeyFrame || restartStream_;
+      restartStream_ = false;
+    }
+
+    try
+    {
+      encoder_.packFrame(frameSlot->bitmap.data(), frameSlot->keyFrame || forceKeyFrame, packedFrames_[packedFrameIdx]);
+      forceKeyFrame = false;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++packedFrameCount_;
+      }
+
+      framePacked_.notify_one();
+      packedFrameIdx = (packedFrameIdx + 1) % std::size(packedFrames_);
+    }
+    catch(...)
+    {
+      // Encoder state is unknown, the next frame starts from scratch.
+      forceKeyFrame = true;
+      setError();
+    }
+
+    // Packed frame holds everything compression needs, slot is free already.
+    frameRing_.pop();
+
+    // Same handshake as in submitFrame(), with roles swapped.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if(producerWaiting_.load(std::memory_order_relaxed))
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      frameEncoded_.notify_one();
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    analysisStopped_ = true;
+  }
+
+  framePacked_.notify_one();
+}
+
+
+void AsyncEncoder::compressionThread()
+{
+  std::vector<std::byte> outputBuffer(encoder_.safeOutputBufferSize());
+  std::size_t packedFrameIdx = 0;
+  auto dropFrames = false;
+
+  while(true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      framePacked_.wait(lock, [this]() { return packedFrameCount_ > 0 || analysisStopped_; });
+
+      if(packedFrameCount_ == 0)
+        return;
+    }
+
+    auto& packedFrame = packedFrames_[packedFrameIdx];
+    auto failed = false;
+
+    // After a failure, frames continuing the broken stream are dropped until
+    // a key frame starts a new one.
+    if(!dropFrames || packedFrame.frameType.keyFrame)
+    {
+      try
+      {
+        dropFrames = false;
+
+        auto encodeResult = encoder_.compressFrame(packedFrame, outputBuffer.data());
+        outputCallback_(outputBuffer.data(), encodeResult);
+      }
+      catch(...)
+      {
+        dropFrames = true;
+        failed = true;
+        setError();
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      --packedFrameCount_;
+      restartStream_ = restartStream_ || failed;
+    }
+
+    packedFrameIdx = (packedFrameIdx + 1) % std::size(packedFrames_);
+
+    frameCompressed_.notify_one();
+    frameEncoded_.notify_one();
+  }
+}
+
+
+} // namespace lpvc
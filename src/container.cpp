@@ -0,0 +1,328 @@
+#include <lpvc/container.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+  #define NOMINMAX
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+
+namespace lpvc
+{
+
+
+std::size_t Decoder::seekStart(const ContainerReader& containerReader, std::size_t frameIndex) const
+{
+  auto keyFrameIndex = containerReader.keyFrameIndex(frameIndex);
+
+  if(seekContainerId_ == containerReader.id_ &&
+     seekFrameIndex_ >= keyFrameIndex &&
+     seekFrameIndex_ < frameIndex)
+  {
+    return seekFrameIndex_ + 1;
+  }
+
+  return keyFrameIndex;
+}
+
+
+static constexpr char containerMagic[4] = { 'L', 'P', 'V', 'C' };
+static constexpr std::uint16_t containerFormatVersion = 1;
+static constexpr std::size_t containerHeaderSize = 32;
+static constexpr std::size_t containerFrameEntrySize = 13;
+static constexpr std::uint8_t containerKeyFrameFlag = 0x01;
+
+static std::atomic<std::uint64_t> containerReaderCount { 0 };
+
+
+#if defined(_WIN32)
+
+MappedFile::MappedFile(const std::string& path)
+{
+  auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+  if(file == INVALID_HANDLE_VALUE)
+    throw std::runtime_error("Failed to open file.");
+
+  LARGE_INTEGER fileSize;
+
+  if(!GetFileSizeEx(file, &fileSize))
+  {
+    CloseHandle(file);
+    throw std::runtime_error("Failed to get file size.");
+  }
+
+  fileHandle_ = file;
+  size_ = static_cast<std::size_t>(fileSize.QuadPart);
+
+  // Empty files can't be mapped.
+  if(size_ == 0)
+    return;
+
+  mappingHandle_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  auto data = mappingHandle_ ? MapViewOfFile(mappingHandle_, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+  if(!data)
+  {
+    if(mappingHandle_)
+      CloseHandle(mappingHandle_);
+
+    CloseHandle(file);
+    throw std::runtime_error("Failed to map file.");
+  }
+
+  data_ = static_cast<const std::byte*>(data);
+}
+
+
+MappedFile::~MappedFile()
+{
+  if(data_)
+    UnmapViewOfFile(data_);
+
+  if(mappingHandle_)
+    CloseHandle(mappingHandle_);
+
+  CloseHandle(fileHandle_);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path)
+{
+  auto file = open(path.c_str(), O_RDONLY);
+
+  if(file == -1)
+    throw std::runtime_error("Failed to open file.");
+
+  struct stat fileStatus;
+
+  if(fstat(file, &fileStatus) != 0)
+  {
+    close(file);
+    throw std::runtime_error("Failed to get file size.");
+  }
+
+  size_ = static_cast<std::size_t>(fileStatus.st_size);
+
+  // Empty files can't be mapped. Mapping stays valid after closing the file.
+  if(size_ != 0)
+  {
+    auto data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0);
+
+    if(data == MAP_FAILED)
+    {
+      close(file);
+      throw std::runtime_error("Failed to map file.");
+    }
+
+    data_ = static_cast<const std::byte*>(data);
+  }
+
+  close(file);
+}
+
+
+MappedFile::~MappedFile()
+{
+  if(data_)
+    munmap(const_cast<std::byte*>(data_), size_);
+}
+
+#endif
+
+
+ContainerWriter::ContainerWriter(const std::string& path, const BitmapInfo& bitmapInfo) :
+  file_(path, std::ios::binary | std::ios::trunc),
+  bitmapInfo_(bitmapInfo)
+{
+  if(!file_)
+    throw std::runtime_error("Failed to create container file.");
+
+  // Header is rewritten by finish(), once frame count and table offset are
+  // known.
+  std::array<std::byte, containerHeaderSize> header = {};
+  file_.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+  offset_ = header.size();
+}
+
+
+ContainerWriter::~ContainerWriter()
+{
+  try
+  {
+    finish();
+  }
+  catch(...)
+  {
+  }
+}
+
+
+void ContainerWriter::write(const std::byte* frame, std::size_t frameSize, bool keyFrame)
+{
+  if(finished_)
+    throw std::logic_error("Container is already finished.");
+
+  if(frameSize > std::numeric_limits<std::uint32_t>::max())
+    throw std::length_error("Frame is too large.");
+
+  if(!file_.write(reinterpret_cast<const char*>(frame), frameSize))
+    throw std::runtime_error("Failed to write container file.");
+
+  frameTable_.push_back({ offset_, static_cast<std::uint32_t>(frameSize), keyFrame });
+  offset_ += frameSize;
+}
+
+
+void ContainerWriter::finish()
+{
+  if(finished_)
+    return;
+
+  finished_ = true;
+
+  std::vector<std::byte> frameTable(frameTable_.size() * containerFrameEntrySize);
+  BufferWriter frameTableWriter(frameTable.data(), frameTable.size());
+
+  for(const auto& frameEntry : frameTable_)
+  {
+    frameTableWriter.writeUInt64(frameEntry.offset);
+    frameTableWriter.writeUInt32(frameEntry.size);
+    frameTableWriter.writeUInt8(frameEntry.keyFrame ? containerKeyFrameFlag : 0);
+  }
+
+  std::array<std::byte, containerHeaderSize> header;
+  BufferWriter headerWriter(header.data(), header.size());
+
+  for(auto character : containerMagic)
+    headerWriter.writeUInt8(character);
+
+  headerWriter.writeUInt16(containerFormatVersion);
+  headerWriter.writeUInt16(0);
+  headerWriter.writeUInt32(bitmapInfo_.width);
+  headerWriter.writeUInt32(bitmapInfo_.height);
+  headerWriter.writeUInt64(frameTable_.size());
+  headerWriter.writeUInt64(offset_);
+
+  file_.write(reinterpret_cast<const char*>(frameTable.data()), frameTable.size());
+  file_.seekp(0);
+  file_.write(reinterpret_cast<const char*>(header.data()), header.size());
+  file_.close();
+
+  if(!file_)
+    throw std::runtime_error("Failed to write container file.");
+}
+
+
+ContainerReader::ContainerReader(const std::string& path) :
+  file_(path),
+  id_(++containerReaderCount)
+{
+  BufferReader headerReader(file_.data(), file_.size());
+
+  // Header of unfinished containers is left zeroed.
+  if(file_.size() < containerHeaderSize ||
+     std::memcmp(file_.data(), containerMagic, sizeof(containerMagic)) != 0)
+  {
+    throw std::runtime_error("Not an LPVC container.");
+  }
+
+  headerReader.advance(sizeof(containerMagic));
+
+  if(headerReader.readUInt16() != containerFormatVersion)
+    throw std::runtime_error("Unsupported container format version.");
+
+  headerReader.advance(sizeof(std::uint16_t));
+
+  bitmapInfo_.width = headerReader.readUInt32();
+  bitmapInfo_.height = headerReader.readUInt32();
+  auto frameCount = headerReader.readUInt64();
+  auto frameTableOffset = headerReader.readUInt64();
+
+  if(frameTableOffset < containerHeaderSize ||
+     frameTableOffset > file_.size() ||
+     frameCount > (file_.size() - frameTableOffset) / containerFrameEntrySize)
+  {
+    throw std::runtime_error("Corrupted container frame table.");
+  }
+
+  frameCount_ = static_cast<std::size_t>(frameCount);
+  frameTable_ = file_.data() + frameTableOffset;
+
+  // Validating all entries up front lets frame() skip the checks.
+  BufferReader frameTableReader(frameTable_, frameCount_ * containerFrameEntrySize);
+
+  for(std::size_t frameIdx = 0; frameIdx != frameCount_; ++frameIdx)
+  {
+    auto offset = frameTableReader.readUInt64();
+    auto size = frameTableReader.readUInt32();
+    auto flags = frameTableReader.readUInt8();
+
+    if(offset < containerHeaderSize || offset > frameTableOffset || size > frameTableOffset - offset)
+      throw std::runtime_error("Corrupted container frame table.");
+
+    if(flags & containerKeyFrameFlag)
+      keyFrames_.push_back(frameIdx);
+  }
+}
+
+
+const BitmapInfo& ContainerReader::bitmapInfo() const noexcept
+{
+  return bitmapInfo_;
+}
+
+
+std::size_t ContainerReader::frameCount() const noexcept
+{
+  return frameCount_;
+}
+
+
+ContainerReader::Frame ContainerReader::frame(std::size_t frameIndex) const
+{
+  if(frameIndex >= frameCount_)
+    throw std::out_of_range("Frame index out of range.");
+
+  BufferReader frameEntryReader(frameTable_ + frameIndex * containerFrameEntrySize, containerFrameEntrySize);
+
+  Frame frame;
+  frame.data = file_.data() + frameEntryReader.readUInt64();
+  frame.size = frameEntryReader.readUInt32();
+  frame.keyFrame = (frameEntryReader.readUInt8() & containerKeyFrameFlag) != 0;
+
+  return frame;
+}
+
+
+std::size_t ContainerReader::keyFrameIndex(std::size_t frameIndex) const
+{
+  if(frameIndex >= frameCount_)
+    throw std::out_of_range("Frame index out of range.");
+
+  auto keyFrame = std::upper_bound(keyFrames_.begin(), keyFrames_.end(), frameIndex);
+
+  if(keyFrame == keyFrames_.begin())
+    throw std::runtime_error("No key frame precedes the frame.");
+
+  return *std::prev(keyFrame);
+}
+
+
+} // namespace lpvc
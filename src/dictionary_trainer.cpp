@@ -0,0 +1,48 @@
+#include <lpvc/dictionary_trainer.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <zdict.h>
+
+
+namespace lpvc
+{
+
+
+DictionaryTrainer::DictionaryTrainer(const BitmapInfo& bitmapInfo) :
+  decoder_(bitmapInfo),
+  bitmap_(bitmapInfo.width * bitmapInfo.height)
+{
+}
+
+
+void DictionaryTrainer::addFrame(const std::byte* inputBuffer, std::size_t inputBufferSize)
+{
+  // Set on every call, trainer may have been moved since the last one.
+  decoder_.dictionaryTrainer_ = this;
+  decoder_.decodeInPlace(inputBuffer, inputBufferSize, bitmap_.data());
+}
+
+
+Dictionary DictionaryTrainer::train(std::size_t maxDictionarySize) const
+{
+  std::vector<std::byte> dictionary(maxDictionarySize);
+
+  auto dictionarySize = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(),
+                                              samples_.data(), sampleSizes_.data(), static_cast<unsigned int>(sampleSizes_.size()));
+
+  if(ZDICT_isError(dictionarySize))
+    throw std::runtime_error(std::string("Dictionary training failed: ") + ZDICT_getErrorName(dictionarySize));
+
+  return Dictionary(dictionary.data(), dictionarySize);
+}
+
+
+void DictionaryTrainer::addSample(const std::byte* sample, std::size_t sampleSize)
+{
+  samples_.insert(samples_.end(), sample, sample + sampleSize);
+  sampleSizes_.push_back(sampleSize);
+}
+
+
+} // namespace lpvc
@@ -1,5 +1,11 @@
 #include <lpvc/lpvc.h>
+#include <lpvc/dictionary_trainer.h>
 #include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
 #include <tuple>
 
 
@@ -23,9 +29,29 @@ bool Color::operator!=(const Color& other) const noexcept
 
 std::size_t ColorHash::operator()(const Color& color) const noexcept
 {
-  return (std::to_integer<std::size_t>(color.r) << 0) |
-         (std::to_integer<std::size_t>(color.g) << 8) |
-         (std::to_integer<std::size_t>(color.b) << 16);
+  return packColor(color);
+}
+
+
+std::size_t pixelSize(PixelFormat pixelFormat)
+{
+  switch(pixelFormat)
+  {
+    case PixelFormat::RGB24:
+    case PixelFormat::BGR24:
+      return 3;
+
+    case PixelFormat::RGBX32:
+    case PixelFormat::BGRX32:
+    case PixelFormat::RGBA32:
+    case PixelFormat::BGRA32:
+      return 4;
+
+    case PixelFormat::RGB565:
+      return 2;
+  }
+
+  throw std::invalid_argument("Invalid pixel format.");
 }
 
 
@@ -102,6 +128,9 @@ std::size_t Palette::bits() const
 
 Palette Palette::difference(const Palette& other) const
 {
+  if(!std::is_sorted(begin(), begin() + size_, ColorOrdering()))
+    return sorted().difference(other);
+
   Palette palette;
 
   palette.size_ = std::set_difference(other.begin(), other.begin() + other.size_, begin(), begin() + size_, palette.begin(), ColorOrdering()) - palette.begin();
@@ -112,6 +141,9 @@ Palette Palette::difference(const Palette& other) const
 
 Palette Palette::merge(const Palette& other) const
 {
+  if(!std::is_sorted(begin(), begin() + size_, ColorOrdering()))
+    return sorted().merge(other);
+
   Palette palette;
 
   palette.size_ = std::set_union(other.begin(), other.begin() + other.size_, begin(), begin() + size_, palette.begin(), ColorOrdering()) - palette.begin();
@@ -120,6 +152,52 @@ Palette Palette::merge(const Palette& other) const
 }
 
 
+Palette Palette::sorted() const
+{
+  auto palette = *this;
+
+  std::sort(palette.begin(), palette.begin() + palette.size_, ColorOrdering());
+
+  return palette;
+}
+
+
+const Palette& PaletteCache::palette(std::size_t slot) const noexcept
+{
+  return entries_[slot].palette;
+}
+
+
+void PaletteCache::store(Palette& palette, ColorMap& colorMap)
+{
+  swap(nextSlot_, palette, colorMap);
+  nextSlot_ = (nextSlot_ + 1) % slotCount;
+
+  palette.clear();
+  colorMap.clear();
+}
+
+
+void PaletteCache::swap(std::size_t slot, Palette& palette, ColorMap& colorMap)
+{
+  // Color maps are swapped without copying their tables.
+  std::swap(entries_[slot].palette, palette);
+  std::swap(entries_[slot].colorMap, colorMap);
+}
+
+
+void PaletteCache::clear() noexcept
+{
+  for(auto& entry : entries_)
+  {
+    entry.palette.clear();
+    entry.colorMap.clear();
+  }
+
+  nextSlot_ = 0;
+}
+
+
 static void writeColor(BufferWriter& bufferWriter, const Color& color)
 {
   bufferWriter.writeByte(color.r);
@@ -140,6 +218,375 @@ static Color readColor(BufferReader& bufferReader)
 }
 
 
+template<std::size_t PixelSize, std::size_t R, std::size_t G, std::size_t B>
+static void convertPixels(const std::byte* source, std::size_t count, Color* destination) noexcept
+{
+  for(std::size_t pixelIdx = 0; pixelIdx != count; ++pixelIdx, source += PixelSize)
+    destination[pixelIdx] = { source[R], source[G], source[B] };
+}
+
+
+template<PixelFormat Format>
+static void convertPixels(const std::byte* source, std::size_t count, Color* destination) noexcept
+{
+  if constexpr(Format == PixelFormat::RGB24)
+  {
+    std::memcpy(destination, source, count * sizeof(Color));
+  }
+  else if constexpr(Format == PixelFormat::BGR24)
+  {
+    convertPixels<3, 2, 1, 0>(source, count, destination);
+  }
+  else if constexpr(Format == PixelFormat::RGBX32 || Format == PixelFormat::RGBA32)
+  {
+    convertPixels<4, 0, 1, 2>(source, count, destination);
+  }
+  else if constexpr(Format == PixelFormat::BGRX32 || Format == PixelFormat::BGRA32)
+  {
+    convertPixels<4, 2, 1, 0>(source, count, destination);
+  }
+  else
+  {
+    static_assert(Format == PixelFormat::RGB565);
+
+    // Channels are widened by repeating their top bits, so full intensity
+    // stays full.
+    for(std::size_t pixelIdx = 0; pixelIdx != count; ++pixelIdx, source += 2)
+    {
+      auto pixel = std::to_integer<unsigned int>(source[0]) | (std::to_integer<unsigned int>(source[1]) << 8);
+      auto r = (pixel >> 11) & 0x1F;
+      auto g = (pixel >> 5) & 0x3F;
+      auto b = pixel & 0x1F;
+
+      destination[pixelIdx] = { static_cast<std::byte>((r << 3) | (r >> 2)),
+                                static_cast<std::byte>((g << 2) | (g >> 4)),
+                                static_cast<std::byte>((b << 3) | (b >> 2)) };
+    }
+  }
+}
+
+
+template<std::size_t PixelSize, std::size_t R, std::size_t G, std::size_t B>
+static void formatPixels(const Color* source, std::size_t count, std::byte* destination) noexcept
+{
+  for(std::size_t pixelIdx = 0; pixelIdx != count; ++pixelIdx, destination += PixelSize)
+  {
+    destination[R] = source[pixelIdx].r;
+    destination[G] = source[pixelIdx].g;
+    destination[B] = source[pixelIdx].b;
+
+    if constexpr(PixelSize == 4)
+      destination[3] = std::byte{0xFF};
+  }
+}
+
+
+// Inverse of convertPixels<Format>(), RGB565 channels are truncated.
+static void formatPixels(const Color* source, std::size_t count, PixelFormat pixelFormat, std::byte* destination)
+{
+  switch(pixelFormat)
+  {
+    case PixelFormat::RGB24:
+      std::memcpy(destination, source, count * sizeof(Color));
+      break;
+
+    case PixelFormat::BGR24:
+      formatPixels<3, 2, 1, 0>(source, count, destination);
+      break;
+
+    case PixelFormat::RGBX32:
+    case PixelFormat::RGBA32:
+      formatPixels<4, 0, 1, 2>(source, count, destination);
+      break;
+
+    case PixelFormat::BGRX32:
+    case PixelFormat::BGRA32:
+      formatPixels<4, 2, 1, 0>(source, count, destination);
+      break;
+
+    case PixelFormat::RGB565:
+      for(std::size_t pixelIdx = 0; pixelIdx != count; ++pixelIdx, destination += 2)
+      {
+        auto pixel = ((std::to_integer<unsigned int>(source[pixelIdx].r) >> 3) << 11) |
+                     ((std::to_integer<unsigned int>(source[pixelIdx].g) >> 2) << 5) |
+                     (std::to_integer<unsigned int>(source[pixelIdx].b) >> 3);
+
+        destination[0] = static_cast<std::byte>(pixel);
+        destination[1] = static_cast<std::byte>(pixel >> 8);
+      }
+      break;
+
+    default:
+      throw std::invalid_argument("Invalid pixel format.");
+  }
+}
+
+
+// Copies pixels of a palette already converted by formatPixels().
+template<std::size_t PixelSize>
+static void lookupPixels(const std::uint8_t* indices, std::size_t count, const std::byte* formattedPalette, std::byte* destination) noexcept
+{
+  for(std::size_t pixelIdx = 0; pixelIdx != count; ++pixelIdx)
+    std::memcpy(destination + pixelIdx * PixelSize, formattedPalette + indices[pixelIdx] * PixelSize, PixelSize);
+}
+
+
+// Calls rowFunction(row, offset, count) for every row segment of pixels in
+// range [offset, offset + count) of a bitmap with given pitch.
+template<typename Byte, typename RowFunction>
+static void forEachRow(Byte* bitmap, std::ptrdiff_t pitch, std::size_t pixelSize, std::size_t width,
+                       std::size_t offset, std::size_t count, RowFunction&& rowFunction)
+{
+  while(count != 0)
+  {
+    auto y = offset / width;
+    auto x = offset % width;
+    auto rowCount = std::min(count, width - x);
+
+    rowFunction(bitmap + static_cast<std::ptrdiff_t>(y) * pitch + x * pixelSize, offset, rowCount);
+
+    offset += rowCount;
+    count -= rowCount;
+  }
+}
+
+
+static void updateColorMap(ColorMap& colorMap, const Palette& palette, const Palette& mergedPalette)
+{
+  // Merged colors keep their order, so indices below the first inserted color
+  // stay valid. Only the remaining part of the color map has to be updated.
+  auto firstChangedColor = std::mismatch(palette.begin(), palette.end(), mergedPalette.begin()).second;
+
+  for(auto color = firstChangedColor; color != mergedPalette.end(); ++color)
+  {
+    auto packedColor = packColor(*color);
+    auto paletteIndex = static_cast<unsigned char>(color - mergedPalette.begin());
+
+    if(auto colorMapIndex = colorMap.find(packedColor))
+      *colorMapIndex = paletteIndex;
+    else
+      colorMap.insert(packedColor, paletteIndex);
+  }
+}
+
+
+namespace
+{
+
+// Looks up palette indices, remembering the last color since neighbouring
+// pixels tend to share it.
+template<typename Index, std::size_t Capacity>
+class PaletteIndexLookup final
+{
+public:
+  PaletteIndexLookup(const ColorTable<Index, Capacity>& colorMap) noexcept :
+    colorMap_(colorMap)
+  {
+  }
+
+  Index operator()(const Color& color)
+  {
+    auto packedColor = packColor(color);
+
+    if(packedColor != lastColor_)
+    {
+      auto colorMapIndex = colorMap_.find(packedColor);
+
+      if(!colorMapIndex)
+        throw std::runtime_error("Color missing from palette.");
+
+      lastColor_ = packedColor;
+      lastIndex_ = *colorMapIndex;
+    }
+
+    return lastIndex_;
+  }
+
+private:
+  const ColorTable<Index, Capacity>& colorMap_;
+  std::uint32_t lastColor_ = 0xFFFFFFFF; // See Encoder::addPaletteColors.
+  Index lastIndex_ = 0;
+};
+
+} // namespace
+
+
+// Indices are gathered in chunks small enough to stay in cache and packed
+// right away. Chunk size has to be a multiple of 8, so that every chunk starts
+// on a byte boundary.
+static constexpr std::size_t indexChunkSize = 4096;
+
+
+template<typename IndexFunction>
+static void writeIndexedBitmap(BufferWriter& bufferWriter, std::size_t paletteBits, std::size_t pixelCount, IndexFunction&& indexFunction)
+{
+  std::array<std::uint8_t, indexChunkSize> paletteIndices;
+
+  bufferWriter.writeUInt8(paletteBits);
+
+  for(std::size_t chunkOffset = 0; chunkOffset < pixelCount; chunkOffset += indexChunkSize)
+  {
+    auto chunkSize = std::min(indexChunkSize, pixelCount - chunkOffset);
+
+    for(std::size_t pixelIdx = 0; pixelIdx != chunkSize; ++pixelIdx)
+      paletteIndices[pixelIdx] = indexFunction(chunkOffset + pixelIdx);
+
+    auto packedOutput = bufferWriter.data() + bufferWriter.offset();
+
+    bufferWriter.advance(packedIndicesSize(paletteBits, chunkSize));
+    packIndices(paletteBits, paletteIndices.data(), chunkSize, packedOutput);
+  }
+}
+
+
+// Allows unpackIndices to produce raw indices.
+static const std::uint8_t* identityPalette() noexcept
+{
+  static const auto palette = []()
+  {
+    std::array<std::uint8_t, 256> palette;
+
+    for(std::size_t idx = 0; idx != palette.size(); ++idx)
+      palette[idx] = static_cast<std::uint8_t>(idx);
+
+    return palette;
+  }();
+
+  return palette.data();
+}
+
+
+// Calls function(tileIdx, x, y, width, height) for every tile of the bitmap,
+// row by row. Tiles at the right and bottom edges may be smaller.
+template<typename Function>
+static void forEachTile(const BitmapInfo& bitmapInfo, std::size_t tileWidth, std::size_t tileHeight, Function&& function)
+{
+  std::size_t tileIdx = 0;
+
+  for(std::size_t y = 0; y < bitmapInfo.height; y += tileHeight)
+  {
+    for(std::size_t x = 0; x < bitmapInfo.width; x += tileWidth, ++tileIdx)
+      function(tileIdx, x, y, std::min(tileWidth, bitmapInfo.width - x), std::min(tileHeight, bitmapInfo.height - y));
+  }
+}
+
+
+static std::size_t tileCount(const BitmapInfo& bitmapInfo, std::size_t tileWidth, std::size_t tileHeight) noexcept
+{
+  return ((bitmapInfo.width + tileWidth - 1) / tileWidth) *
+         ((bitmapInfo.height + tileHeight - 1) / tileHeight);
+}
+
+
+// Calls function(offset, sourceOffset, count) for row segments covering the
+// whole bitmap shifted by (scrollX, scrollY). Pixels uncovered by the shift
+// come from their own position, i.e. offset == sourceOffset. Rows are visited
+// in an order which allows shifting a bitmap in place.
+template<typename Function>
+static void forEachScrolledSegment(const BitmapInfo& bitmapInfo, int scrollX, int scrollY, Function&& function)
+{
+  const auto width = static_cast<std::ptrdiff_t>(bitmapInfo.width);
+  const auto height = static_cast<std::ptrdiff_t>(bitmapInfo.height);
+  const auto begin = std::max<std::ptrdiff_t>(scrollX, 0);
+  const auto end = std::min<std::ptrdiff_t>(width, width + scrollX);
+
+  for(std::ptrdiff_t rowIdx = 0; rowIdx != height; ++rowIdx)
+  {
+    auto y = (scrollY > 0) ? height - 1 - rowIdx : rowIdx;
+    auto offset = static_cast<std::size_t>(y * width);
+    auto sourceY = y - scrollY;
+
+    if(sourceY < 0 || sourceY >= height || begin >= end)
+    {
+      function(offset, offset, bitmapInfo.width);
+      continue;
+    }
+
+    auto sourceOffset = static_cast<std::size_t>(sourceY * width);
+
+    if(begin != 0)
+      function(offset, offset, begin);
+
+    function(offset + begin, sourceOffset + begin - scrollX, end - begin);
+
+    if(end != width)
+      function(offset + end, offset + end, width - end);
+  }
+}
+
+
+// Number of pixels uncovered by shifting a bitmap by (scrollX, scrollY).
+static std::size_t exposedPixelCount(const BitmapInfo& bitmapInfo, int scrollX, int scrollY) noexcept
+{
+  auto coveredWidth = bitmapInfo.width - std::min<std::size_t>(std::abs(scrollX), bitmapInfo.width);
+  auto coveredHeight = bitmapInfo.height - std::min<std::size_t>(std::abs(scrollY), bitmapInfo.height);
+
+  return bitmapInfo.width * bitmapInfo.height - coveredWidth * coveredHeight;
+}
+
+
+// Sums of all color components of every row and every column.
+static void computeProjections(const BitmapInfo& bitmapInfo, const Color* bitmap, std::uint32_t* rowProjection, std::uint32_t* columnProjection)
+{
+  std::fill_n(columnProjection, bitmapInfo.width, 0);
+
+  for(std::size_t y = 0; y != bitmapInfo.height; ++y)
+  {
+    std::uint32_t rowSum = 0;
+
+    for(std::size_t x = 0; x != bitmapInfo.width; ++x, ++bitmap)
+    {
+      auto sum = std::to_integer<std::uint32_t>(bitmap->r) +
+                 std::to_integer<std::uint32_t>(bitmap->g) +
+                 std::to_integer<std::uint32_t>(bitmap->b);
+
+      rowSum += sum;
+      columnProjection[x] += sum;
+    }
+
+    rowProjection[y] = rowSum;
+  }
+}
+
+
+// Finds shift (within radius) which best aligns previous projection with the
+// current one. Smaller shifts win ties.
+static int findProjectionShift(const std::vector<std::uint32_t>& projection, const std::vector<std::uint32_t>& previousProjection, int radius)
+{
+  const auto size = static_cast<std::ptrdiff_t>(projection.size());
+
+  radius = static_cast<int>(std::min<std::ptrdiff_t>(radius, size - 1));
+
+  auto bestShift = 0;
+  auto bestCost = std::numeric_limits<double>::max();
+
+  for(int distance = 0; distance <= radius; ++distance)
+  {
+    for(auto shift : { distance, -distance })
+    {
+      std::uint64_t difference = 0;
+
+      for(auto idx = std::max<std::ptrdiff_t>(shift, 0); idx != std::min<std::ptrdiff_t>(size, size + shift); ++idx)
+      {
+        auto lhs = projection[idx];
+        auto rhs = previousProjection[idx - shift];
+        difference += (lhs > rhs) ? lhs - rhs : rhs - lhs;
+      }
+
+      auto cost = static_cast<double>(difference) / static_cast<double>(size - distance);
+
+      if(cost < bestCost)
+      {
+        bestCost = cost;
+        bestShift = shift;
+      }
+    }
+  }
+
+  return bestShift;
+}
+
+
 std::size_t KeyFrameBlock::maxSize() noexcept
 {
   return 0;
@@ -186,12 +633,10 @@ void PaletteBlock::encode(Encoder& encoder, BufferWriter& bufferWriter, const Pa
 
   encoder.compressBuffer(bufferWriter, internalBufferWriter.data(), internalBufferWriter.offset());
 
-  //
-  encoder.palette_ = encoder.palette_.merge(palette);
+  auto mergedPalette = encoder.palette_.merge(palette);
 
-  encoder.colorMap_.clear();
-  for(std::size_t colorIdx = 0; colorIdx < encoder.palette_.size(); ++colorIdx)
-    encoder.colorMap_.emplace(encoder.palette_[colorIdx], static_cast<unsigned char>(colorIdx));
+  updateColorMap(encoder.colorMap_, encoder.palette_, mergedPalette);
+  encoder.palette_ = mergedPalette;
 }
 
 
@@ -205,7 +650,10 @@ void PaletteBlock::decode(Decoder& decoder, BufferReader& bufferReader)
   for(Color& color : palette)
     color = readColor(internalBufferReader);
 
-  decoder.palette_ = decoder.palette_.merge(palette);
+  auto mergedPalette = decoder.palette_.merge(palette);
+
+  updateColorMap(decoder.colorMap_, decoder.palette_, mergedPalette);
+  decoder.palette_ = mergedPalette;
 }
 
 
@@ -217,12 +665,14 @@ std::size_t PaletteResetBlock::maxSize() noexcept
 
 void PaletteResetBlock::encode(Encoder& encoder, BufferWriter& bufferWriter)
 {
+  encoder.paletteCache_.store(encoder.palette_, encoder.colorMap_);
   encoder.resetPalette();
 }
 
 
 void PaletteResetBlock::decode(Decoder& decoder, BufferReader& bufferReader)
 {
+  decoder.paletteCache_.store(decoder.palette_, decoder.colorMap_);
   decoder.resetPalette();
 }
 
@@ -241,29 +691,16 @@ std::size_t IndexedBitmapBlock::maxSize(const BitmapInfo& bitmapInfo) noexcept
 void IndexedBitmapBlock::encode(Encoder& encoder, BufferWriter& bufferWriter)
 {
   BufferWriter internalBufferWriter(encoder.internalBuffer_.data(), encoder.internalBuffer_.size());
+  PaletteIndexLookup paletteIndex(encoder.colorMap_);
 
-  auto paletteBits = encoder.palette_.bits();
-  unsigned char compressedBitmap = 0;
-  std::size_t compressedOffset = 0;
-
-  internalBufferWriter.writeUInt8(paletteBits);
-  for(const auto& color : encoder.frameBitmap_)
-  {
-    auto paletteIndex = encoder.colorMap_.at(color);
-
-    compressedBitmap |= (paletteIndex << compressedOffset);
-    compressedOffset += paletteBits;
+  const auto& bitmap = encoder.blockBitmap();
 
-    if(compressedOffset == 8)
+  writeIndexedBitmap(internalBufferWriter, encoder.palette_.bits(), bitmap.size(),
+    [&](std::size_t pixelIdx)
     {
-      internalBufferWriter.writeUInt8(compressedBitmap);
-      compressedBitmap = 0;
-      compressedOffset = 0;
+      return paletteIndex(bitmap[pixelIdx]);
     }
-  }
-
-  if(compressedOffset != 0)
-    internalBufferWriter.writeUInt8(compressedBitmap);
+  );
 
   encoder.compressBuffer(bufferWriter, internalBufferWriter.data(), internalBufferWriter.offset());
 }
@@ -274,24 +711,36 @@ void IndexedBitmapBlock::decode(Decoder& decoder, BufferReader& bufferReader)
   decoder.decompressBuffer(bufferReader, decoder.internalBuffer_.data(), decoder.internalBuffer_.size());
   BufferReader internalBufferReader(decoder.internalBuffer_.data(), decoder.internalBuffer_.size());
 
-  unsigned char compressedBitmap = 0;
-  std::size_t compressedOffset = 8;
+  auto bitmap = decoder.blockBitmap();
   auto paletteBits = internalBufferReader.readUInt8();
+  auto packedBitmap = internalBufferReader.data() + internalBufferReader.offset();
 
-  for(auto& color : decoder.frameBitmap_)
+  internalBufferReader.advance(packedIndicesSize(paletteBits, bitmap.size));
+
+  if(!decoder.writesOutputBitmap())
   {
-    if(compressedOffset == 8)
-    { 
-      compressedBitmap = internalBufferReader.readUInt8();
-      compressedOffset = 0;
-    }
+    unpackIndices(paletteBits, packedBitmap, bitmap.size, decoder.palette_.begin(), bitmap.data);
+    return;
+  }
+
+  // Output pixels are looked up in a palette formatted up front, while the
+  // indices are still in cache. Whole palette is formatted, so that corrupt
+  // indices never read uninitialized pixels.
+  std::array<std::byte, Palette::maxColorCount * 4> formattedPalette;
+  std::array<std::uint8_t, indexChunkSize> paletteIndices;
+
+  formatPixels(decoder.palette_.begin(), Palette::maxColorCount, decoder.outputBitmap_.pixelFormat, formattedPalette.data());
+
+  for(std::size_t chunkOffset = 0; chunkOffset < bitmap.size; chunkOffset += indexChunkSize)
+  {
+    auto chunkSize = std::min(indexChunkSize, bitmap.size - chunkOffset);
+
+    unpackIndices(paletteBits, packedBitmap + chunkOffset * paletteBits / 8, chunkSize, identityPalette(), paletteIndices.data());
 
-    unsigned char paletteIndex = compressedBitmap;
-    paletteIndex <<= 8 - paletteBits - compressedOffset;
-    paletteIndex >>= (8 - paletteBits);
+    for(std::size_t pixelIdx = 0; pixelIdx != chunkSize; ++pixelIdx)
+      bitmap.data[chunkOffset + pixelIdx] = decoder.palette_[paletteIndices[pixelIdx]];
 
-    color = decoder.palette_[paletteIndex];
-    compressedOffset += paletteBits;
+    decoder.writeOutputBitmap(paletteIndices.data(), formattedPalette.data(), chunkOffset, chunkSize);
   }
 }
 
@@ -304,13 +753,20 @@ std::size_t RawBitmapBlock::maxSize(const BitmapInfo& bitmapInfo) noexcept
 
 void RawBitmapBlock::encode(Encoder& encoder, BufferWriter& bufferWriter)
 {
-  encoder.compressBuffer(bufferWriter, reinterpret_cast<const std::byte*>(encoder.frameBitmap_.data()), encoder.frameBitmap_.size() * sizeof(Color));
+  const auto& bitmap = encoder.blockBitmap();
+
+  encoder.compressBuffer(bufferWriter, reinterpret_cast<const std::byte*>(bitmap.data()), bitmap.size() * sizeof(Color));
 }
 
 
 void RawBitmapBlock::decode(Decoder& decoder, BufferReader& bufferReader)
 {
-  decoder.decompressBuffer(bufferReader, reinterpret_cast<std::byte*>(decoder.frameBitmap_.data()), decoder.frameBitmap_.size() * sizeof(Color));
+  auto bitmap = decoder.blockBitmap();
+
+  decoder.decompressBuffer(bufferReader, reinterpret_cast<std::byte*>(bitmap.data), bitmap.size * sizeof(Color));
+
+  if(decoder.writesOutputBitmap())
+    decoder.writeOutputBitmap(bitmap.data, 0, bitmap.size);
 }
 
 
@@ -320,16 +776,21 @@ std::size_t SolidColorBitmapBlock::maxSize() noexcept
 }
 
 
-void SolidColorBitmapBlock::encode(Encoder& encoder, BufferWriter& bufferWriter, const Color& color)
+void SolidColorBitmapBlock::encode(Encoder&, BufferWriter& bufferWriter, const Color& color)
 {
   writeColor(bufferWriter, color);
-  std::fill(encoder.frameBitmap_.begin(), encoder.frameBitmap_.end(), color);
 }
 
 
 void SolidColorBitmapBlock::decode(Decoder& decoder, BufferReader& bufferReader)
 {
-  std::fill(decoder.frameBitmap_.begin(), decoder.frameBitmap_.end(), readColor(bufferReader));
+  auto bitmap = decoder.blockBitmap();
+  auto color = readColor(bufferReader);
+
+  std::fill_n(bitmap.data, bitmap.size, color);
+
+  if(decoder.writesOutputBitmap())
+    decoder.fillOutputBitmap(color);
 }
 
 
@@ -346,142 +807,1891 @@ void NullBitmapBlock::encode(Encoder& encoder, BufferWriter& bufferWriter)
 
 void NullBitmapBlock::decode(Decoder& decoder, BufferReader& bufferReader)
 {
-  decoder.frameBitmap_ = decoder.previousFrameBitmap_;
-}
-
-
-static std::size_t safeInternalOutpuBufferSize(const BitmapInfo& bitmapInfo) noexcept
-{
-  return std::max(PaletteBlock::maxSize(), IndexedBitmapBlock::maxSize(bitmapInfo));
+  decoder.result_.nullFrame = true;
 }
 
 
-Encoder::Encoder(const BitmapInfo& bitmapInfo, const EncoderSettings& settings) :
-  settings_(settings),
-  bitmapInfo_(bitmapInfo),
-  frameBitmap_(bitmapInfo_.width * bitmapInfo_.height),
-  internalBuffer_(safeInternalOutpuBufferSize(bitmapInfo)),
-  colorMap_(Palette::maxColorCount)
+std::size_t IndexedResidualBitmapBlock::maxSize(const BitmapInfo& bitmapInfo) noexcept
 {
-  zstdCompressor_.reset(ZSTD_createCCtx());
-  ZSTD_CCtx_setParameter(zstdCompressor_.get(), ZSTD_c_compressionLevel, settings_.zstdCompressionLevel);
-  ZSTD_CCtx_setParameter(zstdCompressor_.get(), ZSTD_c_nbWorkers, settings_.zstdWorkerCount);
+  return IndexedBitmapBlock::maxSize(bitmapInfo);
 }
 
 
-std::size_t Encoder::safeOutputBufferSize() const noexcept
+void IndexedResidualBitmapBlock::encode(Encoder& encoder, BufferWriter& bufferWriter)
 {
-  auto fullBlockSize = [](std::size_t blockSize)
-  {
-    return sizeof(std::uint8_t) + // Block type id
-           blockSize;             // Block data
-  };
-
-  auto compressedBlockSize = [](std::size_t blockSize)
-  {
-    return sizeof(std::uint32_t) +        // Compressed block size
-           ZSTD_compressBound(blockSize); // Block data 
-  };
+  BufferWriter internalBufferWriter(encoder.internalBuffer_.data(), encoder.internalBuffer_.size());
+  PaletteIndexLookup paletteIndex(encoder.colorMap_);
+  PaletteIndexLookup previousPaletteIndex(encoder.colorMap_);
 
-  const auto indexedBitmapWithPaletteSize = fullBlockSize(compressedBlockSize(PaletteResetBlock::maxSize())) +
-                                            fullBlockSize(compressedBlockSize(PaletteBlock::maxSize())) +
-                                            fullBlockSize(compressedBlockSize(IndexedBitmapBlock::maxSize(bitmapInfo_)));
+  writeIndexedBitmap(internalBufferWriter, encoder.palette_.bits(), encoder.frameBitmap_.size(),
+    [&](std::size_t pixelIdx) -> std::uint8_t
+    {
+      const auto& color = encoder.frameBitmap_[pixelIdx];
+      const auto& previousColor = encoder.previousFrameBitmap_[pixelIdx];
 
-  const auto rawBitmapSize = fullBlockSize(compressedBlockSize(RawBitmapBlock::maxSize(bitmapInfo_)));
+      if(packColor(color) == packColor(previousColor))
+        return 0;
 
-  const auto solidColorBitmapSize = fullBlockSize(SolidColorBitmapBlock::maxSize());
+      return paletteIndex(color) ^ previousPaletteIndex(previousColor);
+    }
+  );
 
-  return fullBlockSize(KeyFrameBlock::maxSize()) +
-         std::max({ indexedBitmapWithPaletteSize, rawBitmapSize, solidColorBitmapSize });
+  encoder.compressBuffer(bufferWriter, internalBufferWriter.data(), internalBufferWriter.offset());
 }
 
 
-void Encoder::updatePalette(BufferWriter& bufferWriter, const Palette& newPalette)
+void IndexedResidualBitmapBlock::decode(Decoder& decoder, BufferReader& bufferReader)
 {
-  auto newColors = palette_.difference(newPalette);
+  decoder.decompressBuffer(bufferReader, decoder.internalBuffer_.data(), decoder.internalBuffer_.size());
+  BufferReader internalBufferReader(decoder.internalBuffer_.data(), decoder.internalBuffer_.size());
 
-  if(newColors.size() > 0)
+  const auto pixelCount = decoder.pixelCount();
+  auto paletteBits = internalBufferReader.readUInt8();
+  auto packedBitmap = internalBufferReader.data() + internalBufferReader.offset();
+  std::array<std::uint8_t, indexChunkSize> residualIndices;
+  PaletteIndexLookup previousPaletteIndex(decoder.colorMap_);
+
+  internalBufferReader.advance(packedIndicesSize(paletteBits, pixelCount));
+
+  for(std::size_t chunkOffset = 0; chunkOffset < pixelCount; chunkOffset += indexChunkSize)
   {
-    auto newPaletteMaxColorCount = (std::size_t(1) << newPalette.bits());
+    auto chunkSize = std::min(indexChunkSize, pixelCount - chunkOffset);
+    auto chunk = decoder.frame_ + chunkOffset;
+    auto previousChunk = decoder.previousFrame_ + chunkOffset;
 
-    if(palette_.size() + newColors.size() > newPaletteMaxColorCount)
-    {
-      if(palette_.size() != 0)
-        writeBlock<PaletteResetBlock>(bufferWriter);
+    unpackIndices(paletteBits, packedBitmap + chunkOffset * paletteBits / 8, chunkSize, identityPalette(), residualIndices.data());
 
-      writeBlock<PaletteBlock>(bufferWriter, newPalette);
-    }
-    else
+    // Chunks may alias, each pixel is read before it's written.
+    for(std::size_t pixelIdx = 0; pixelIdx != chunkSize; ++pixelIdx)
     {
-      writeBlock<PaletteBlock>(bufferWriter, newColors);
+      auto residualIndex = residualIndices[pixelIdx];
+
+      if(residualIndex == 0)
+        chunk[pixelIdx] = previousChunk[pixelIdx];
+      else
+        chunk[pixelIdx] = decoder.palette_[residualIndex ^ previousPaletteIndex(previousChunk[pixelIdx])];
     }
+
+    if(decoder.writesOutputBitmap())
+      decoder.writeOutputBitmap(decoder.frame_, chunkOffset, chunkSize);
   }
 }
 
 
-void Encoder::compressBuffer(BufferWriter& bufferWriter, const std::byte* inputBuffer, std::size_t inputBufferSize)
+std::size_t DirtyTilesBlock::maxSize(const BitmapInfo& bitmapInfo) noexcept
 {
-  auto& compressedSize = bufferWriter.writeUInt32(0); // Placeholder for compressed data size. Set after compression is finished.
-
-  ZSTD_inBuffer zstdInput = { inputBuffer, inputBufferSize, 0 };
-  ZSTD_outBuffer zstdOutput = { bufferWriter.data() + bufferWriter.offset(), bufferWriter.size() - bufferWriter.offset(), 0 };
+  // Runs alternate at every tile at worst (1x1 tiles at most). Runs longer
+  // than maxRunLength are split by an empty run of the other kind.
+  auto maxTileCount = bitmapInfo.width * bitmapInfo.height;
+  auto maxRunCount = maxTileCount + 1 + maxTileCount / maxRunLength * 2;
+  std::size_t size = 0;
 
-  while(zstdInput.pos != zstdInput.size)
-    ZSTD_compressStream2(zstdCompressor_.get(), &zstdOutput , &zstdInput, ZSTD_e_flush);
+  size += sizeof(std::uint8_t); // Tile width
+  size += sizeof(std::uint8_t); // Tile height
+  size += sizeof(std::uint32_t); // Run count
+  size += maxRunCount * sizeof(std::uint16_t); // Run lengths
 
-  compressedSize = static_cast<std::uint32_t>(zstdOutput.pos);
-  bufferWriter.advance(compressedSize);
+  return size;
 }
 
 
-void Encoder::resetPalette()
+void DirtyTilesBlock::encode(Encoder& encoder, BufferWriter& bufferWriter)
 {
-  palette_.clear();
-  colorMap_.clear();
+  // Few tiles change between frames, their runs take less space than flags
+  // of all tiles. They're stored uncompressed, flushing a compressed block
+  // this small costs more than it saves.
+  const auto& dirtyTiles = encoder.dirtyTiles_;
+  std::uint32_t runCount = 0;
+  std::uint8_t dirty = 0;
+
+  bufferWriter.writeUInt8(Encoder::dirtyTileSize);
+  bufferWriter.writeUInt8(Encoder::dirtyTileSize);
+
+  auto runCountOffset = bufferWriter.offset();
+
+  bufferWriter.advance(sizeof(std::uint32_t)); // Run count, written below
+
+  for(std::size_t tileIdx = 0; tileIdx != dirtyTiles.size(); ++runCount, dirty ^= 1)
+  {
+    std::size_t runLength = 0;
+
+    for(; tileIdx != dirtyTiles.size() && dirtyTiles[tileIdx] == dirty && runLength != maxRunLength; ++tileIdx)
+      ++runLength;
+
+    bufferWriter.writeUInt16(runLength);
+  }
+
+  BufferWriter(bufferWriter.data() + runCountOffset, sizeof(std::uint32_t)).writeUInt32(runCount);
+
+  forEachTile(encoder.bitmapInfo_, Encoder::dirtyTileSize, Encoder::dirtyTileSize,
+    [&](std::size_t tileIdx, std::size_t x, std::size_t y, std::size_t width, std::size_t height)
+    {
+      if(!dirtyTiles[tileIdx])
+        return;
+
+      for(auto row = encoder.frameBitmap_.begin() + y * encoder.bitmapInfo_.width + x; height != 0; --height, row += encoder.bitmapInfo_.width)
+        encoder.tileBitmap_.insert(encoder.tileBitmap_.end(), row, row + width);
+    }
+  );
+}
+
+
+void DirtyTilesBlock::decode(Decoder& decoder, BufferReader& bufferReader)
+{
+  decoder.dirtyTileWidth_ = bufferReader.readUInt8();
+  decoder.dirtyTileHeight_ = bufferReader.readUInt8();
+
+  if(decoder.dirtyTileWidth_ == 0 || decoder.dirtyTileHeight_ == 0)
+    throw std::runtime_error("Invalid dirty tile size.");
+
+  auto& dirtyTiles = decoder.dirtyTiles_;
+  auto runCount = bufferReader.readUInt32();
+  std::size_t tileIdx = 0;
+  std::uint8_t dirty = 0;
+
+  dirtyTiles.resize(tileCount(decoder.bitmapInfo_, decoder.dirtyTileWidth_, decoder.dirtyTileHeight_));
+
+  for(; runCount != 0; --runCount, dirty ^= 1)
+  {
+    std::size_t runLength = bufferReader.readUInt16();
+
+    if(runLength > dirtyTiles.size() - tileIdx)
+      throw std::runtime_error("Invalid dirty tile runs.");
+
+    std::fill_n(dirtyTiles.begin() + tileIdx, runLength, dirty);
+    tileIdx += runLength;
+  }
+
+  if(tileIdx != dirtyTiles.size())
+    throw std::runtime_error("Invalid dirty tile runs.");
+
+  std::size_t pixelCount = 0;
+
+  forEachTile(decoder.bitmapInfo_, decoder.dirtyTileWidth_, decoder.dirtyTileHeight_,
+    [&](std::size_t tileIdx, std::size_t, std::size_t, std::size_t width, std::size_t height)
+    {
+      if(dirtyTiles[tileIdx])
+        pixelCount += width * height;
+    }
+  );
+
+  decoder.tileBitmap_.resize(pixelCount);
+
+  // Bitmaps owned by the decoder aren't handed out, clean tiles may stay
+  // where they are in the previous frame instead of being copied over.
+  if(decoder.ownsBitmap(decoder.previousFrame_))
+    decoder.frame_ = decoder.previousFrame_;
+}
+
+
+std::size_t ScrollBlock::maxSize(const BitmapInfo& bitmapInfo) noexcept
+{
+  std::size_t size = 0;
+
+  size += sizeof(std::int16_t); // Horizontal shift
+  size += sizeof(std::int16_t); // Vertical shift
+  size += bitmapInfo.width * bitmapInfo.height * sizeof(Color); // Exposed pixels (less than the whole frame)
+
+  return size;
+}
+
+
+void ScrollBlock::encode(Encoder& encoder, BufferWriter& bufferWriter, int x, int y)
+{
+  BufferWriter internalBufferWriter(encoder.internalBuffer_.data(), encoder.internalBuffer_.size());
+
+  internalBufferWriter.writeInt16(x);
+  internalBufferWriter.writeInt16(y);
+
+  // Exposed pixels take their values from the frame being coded, following
+  // blocks see them unchanged.
+  forEachScrolledSegment(encoder.bitmapInfo_, x, y,
+    [&](std::size_t offset, std::size_t sourceOffset, std::size_t count)
+    {
+      auto destination = encoder.scrolledFrameBitmap_.begin() + offset;
+
+      if(offset != sourceOffset)
+      {
+        std::copy_n(encoder.previousFrameBitmap_.begin() + sourceOffset, count, destination);
+        return;
+      }
+
+      std::copy_n(encoder.frameBitmap_.begin() + offset, count, destination);
+
+      for(auto pixel = encoder.frameBitmap_.begin() + offset; count != 0; --count, ++pixel)
+        writeColor(internalBufferWriter, *pixel);
+    }
+  );
+
+  encoder.compressBuffer(bufferWriter, internalBufferWriter.data(), internalBufferWriter.offset());
+  encoder.previousFrameBitmap_.swap(encoder.scrolledFrameBitmap_);
+}
+
+
+void ScrollBlock::decode(Decoder& decoder, BufferReader& bufferReader)
+{
+  decoder.decompressBuffer(bufferReader, decoder.internalBuffer_.data(), decoder.internalBuffer_.size());
+  BufferReader internalBufferReader(decoder.internalBuffer_.data(), decoder.internalBuffer_.size());
+
+  auto x = static_cast<std::int16_t>(internalBufferReader.readInt16());
+  auto y = static_cast<std::int16_t>(internalBufferReader.readInt16());
+
+  if(x == 0 && y == 0)
+    throw std::runtime_error("Invalid scroll.");
+
+  // Frame may be shifted in place, segments within a row never overlap
+  // other segments still to be read. Exposed pixels may be sources of such
+  // segments, they're filled once the shift is done.
+  forEachScrolledSegment(decoder.bitmapInfo_, x, y,
+    [&](std::size_t offset, std::size_t sourceOffset, std::size_t count)
+    {
+      if(offset != sourceOffset)
+        std::memmove(decoder.frame_ + offset, decoder.previousFrame_ + sourceOffset, count * sizeof(Color));
+    }
+  );
+
+  forEachScrolledSegment(decoder.bitmapInfo_, x, y,
+    [&](std::size_t offset, std::size_t sourceOffset, std::size_t count)
+    {
+      if(offset != sourceOffset)
+        return;
+
+      for(auto pixel = decoder.frame_ + offset; count != 0; --count, ++pixel)
+        *pixel = readColor(internalBufferReader);
+    }
+  );
+
+  // Remaining blocks update the shifted frame in place.
+  decoder.previousFrame_ = decoder.frame_;
+  decoder.frameScrolled_ = true;
+}
+
+
+std::size_t PaletteRecallBlock::maxSize() noexcept
+{
+  return sizeof(std::uint8_t); // Slot
+}
+
+
+void PaletteRecallBlock::encode(Encoder& encoder, BufferWriter& bufferWriter, std::size_t slot)
+{
+  bufferWriter.writeUInt8(slot);
+
+  encoder.paletteCache_.swap(slot, encoder.palette_, encoder.colorMap_);
+  encoder.previousFrameInPalette_ = false;
+}
+
+
+void PaletteRecallBlock::decode(Decoder& decoder, BufferReader& bufferReader)
+{
+  auto slot = bufferReader.readUInt8();
+
+  if(slot >= PaletteCache::slotCount || decoder.paletteCache_.palette(slot).size() == 0)
+    throw std::runtime_error("Invalid palette cache slot.");
+
+  decoder.paletteCache_.swap(slot, decoder.palette_, decoder.colorMap_);
+}
+
+
+// Appends colors missing from the palette in their order.
+static Palette appendColors(const Palette& palette, const ColorMap& colorMap, const Palette& colors)
+{
+  std::vector<Color> appendedColors(palette.begin(), palette.end());
+
+  for(const auto& color : colors)
+  {
+    if(colorMap.find(packColor(color)) == nullptr)
+      appendedColors.push_back(color);
+  }
+
+  if(appendedColors.size() > Palette::maxColorCount)
+    throw std::runtime_error("Too many palette colors.");
+
+  return Palette(appendedColors.begin(), appendedColors.end());
+}
+
+
+std::size_t PaletteOrderBlock::maxSize() noexcept
+{
+  return PaletteBlock::maxSize();
+}
+
+
+void PaletteOrderBlock::encode(Encoder& encoder, BufferWriter& bufferWriter, const Palette& palette)
+{
+  if(palette.size() == 0)
+    throw std::logic_error("Palettes with 0 colors are not allowed.");
+
+  bufferWriter.writeUInt8(palette.size() - 1); // See PaletteBlock::encode.
+
+  for(const auto& color : palette)
+    writeColor(bufferWriter, color);
+
+  auto appendedPalette = appendColors(encoder.palette_, encoder.colorMap_, palette);
+
+  updateColorMap(encoder.colorMap_, encoder.palette_, appendedPalette);
+  encoder.palette_ = appendedPalette;
+}
+
+
+void PaletteOrderBlock::decode(Decoder& decoder, BufferReader& bufferReader)
+{
+  Palette palette(static_cast<std::size_t>(bufferReader.readUInt8()) + 1);
+
+  for(Color& color : palette)
+    color = readColor(bufferReader);
+
+  auto appendedPalette = appendColors(decoder.palette_, decoder.colorMap_, palette);
+
+  updateColorMap(decoder.colorMap_, decoder.palette_, appendedPalette);
+  decoder.palette_ = appendedPalette;
+}
+
+
+std::size_t WidePaletteBlock::maxSize() noexcept
+{
+  std::size_t size = 0;
+
+  size += sizeof(std::uint8_t); // Reset flag
+  size += sizeof(std::uint16_t); // Color count
+  size += maxColorCount * sizeof(Color); // Colors
+
+  return size;
+}
+
+
+void WidePaletteBlock::encode(Encoder& encoder, BufferWriter& bufferWriter, const std::vector<Color>& colors, bool reset)
+{
+  if(colors.empty())
+    throw std::logic_error("Palettes with 0 colors are not allowed.");
+
+  bufferWriter.writeUInt8(reset);
+  bufferWriter.writeUInt16(colors.size() - 1); // See PaletteBlock::encode.
+
+  for(const auto& color : colors)
+    writeColor(bufferWriter, color);
+
+  if(reset)
+    encoder.wideColorMap_.clear();
+
+  // Appended colors get the next free indices. Encoder never lists colors
+  // already present.
+  for(const auto& color : colors)
+    encoder.wideColorMap_.insert(packColor(color), static_cast<std::uint16_t>(encoder.wideColorMap_.size()));
+}
+
+
+void WidePaletteBlock::decode(Decoder& decoder, BufferReader& bufferReader)
+{
+  auto reset = bufferReader.readUInt8() != 0;
+  auto colorCount = static_cast<std::size_t>(bufferReader.readUInt16()) + 1;
+
+  if(reset)
+    decoder.widePalette_.clear();
+
+  if(decoder.widePalette_.size() + colorCount > maxColorCount)
+    throw std::runtime_error("Too many palette colors.");
+
+  for(std::size_t colorIdx = 0; colorIdx != colorCount; ++colorIdx)
+    decoder.widePalette_.push_back(readColor(bufferReader));
+}
+
+
+std::size_t WideIndexedBitmapBlock::maxSize(const BitmapInfo& bitmapInfo) noexcept
+{
+  return bitmapInfo.width * bitmapInfo.height * sizeof(std::uint16_t); // Index byte planes
+}
+
+
+void WideIndexedBitmapBlock::encode(Encoder& encoder, BufferWriter& bufferWriter)
+{
+  PaletteIndexLookup paletteIndex(encoder.wideColorMap_);
+
+  const auto& bitmap = encoder.blockBitmap();
+  auto lowBytes = encoder.internalBuffer_.data();
+  auto highBytes = lowBytes + bitmap.size();
+
+  for(std::size_t pixelIdx = 0; pixelIdx != bitmap.size(); ++pixelIdx)
+  {
+    auto index = paletteIndex(bitmap[pixelIdx]);
+
+    lowBytes[pixelIdx] = static_cast<std::byte>(index);
+    highBytes[pixelIdx] = static_cast<std::byte>(index >> 8);
+  }
+
+  encoder.compressBuffer(bufferWriter, lowBytes, bitmap.size() * sizeof(std::uint16_t));
+}
+
+
+void WideIndexedBitmapBlock::decode(Decoder& decoder, BufferReader& bufferReader)
+{
+  auto bitmap = decoder.blockBitmap();
+  auto lowBytes = decoder.internalBuffer_.data();
+  auto highBytes = lowBytes + bitmap.size;
+  const auto& palette = decoder.widePalette_;
+
+  decoder.decompressBuffer(bufferReader, lowBytes, bitmap.size * sizeof(std::uint16_t));
+
+  for(std::size_t chunkOffset = 0; chunkOffset < bitmap.size; chunkOffset += indexChunkSize)
+  {
+    auto chunkEnd = std::min(chunkOffset + indexChunkSize, bitmap.size);
+
+    for(auto pixelIdx = chunkOffset; pixelIdx != chunkEnd; ++pixelIdx)
+    {
+      auto index = std::to_integer<std::size_t>(lowBytes[pixelIdx]) |
+                   (std::to_integer<std::size_t>(highBytes[pixelIdx]) << 8);
+
+      if(index >= palette.size())
+        throw std::runtime_error("Invalid palette index.");
+
+      bitmap.data[pixelIdx] = palette[index];
+    }
+
+    if(decoder.writesOutputBitmap())
+      decoder.writeOutputBitmap(bitmap.data, chunkOffset, chunkEnd - chunkOffset);
+  }
+}
+
+
+namespace
+{
+
+// Values are stored in FilteredRawBitmapBlock.
+enum class RawFilter : std::uint8_t
+{
+  None,
+  Sub,
+  Up,
+  Average,
+  Paeth,
+  PreviousFrame
+};
+
+constexpr std::size_t rawFilterCount = 6;
+
+} // namespace
+
+
+static bool usesRowAbove(RawFilter filter) noexcept
+{
+  return filter == RawFilter::Up || filter == RawFilter::Average || filter == RawFilter::Paeth;
+}
+
+
+static std::uint8_t paethPredictor(int left, int above, int aboveLeft) noexcept
+{
+  auto estimate = left + above - aboveLeft;
+  auto leftDistance = std::abs(estimate - left);
+  auto aboveDistance = std::abs(estimate - above);
+  auto aboveLeftDistance = std::abs(estimate - aboveLeft);
+
+  if(leftDistance <= aboveDistance && leftDistance <= aboveLeftDistance)
+    return static_cast<std::uint8_t>(left);
+
+  if(aboveDistance <= aboveLeftDistance)
+    return static_cast<std::uint8_t>(above);
+
+  return static_cast<std::uint8_t>(aboveLeft);
+}
+
+
+// Calls predictionFunction(byteIdx, prediction) for color bytes of a row in
+// order. Only bytes before byteIdx are read from the row, so the function
+// may decode the row in place.
+template<typename PredictionFunction>
+static void forEachPrediction(RawFilter filter, const std::uint8_t* row, const std::uint8_t* above, const std::uint8_t* previous, std::size_t rowSize, PredictionFunction&& predictionFunction)
+{
+  constexpr std::size_t left = sizeof(Color);
+
+  switch(filter)
+  {
+    case RawFilter::None:
+      for(std::size_t byteIdx = 0; byteIdx != rowSize; ++byteIdx)
+        predictionFunction(byteIdx, 0);
+      break;
+
+    case RawFilter::Sub:
+      for(std::size_t byteIdx = 0; byteIdx != left; ++byteIdx)
+        predictionFunction(byteIdx, 0);
+      for(std::size_t byteIdx = left; byteIdx < rowSize; ++byteIdx)
+        predictionFunction(byteIdx, row[byteIdx - left]);
+      break;
+
+    case RawFilter::Up:
+      for(std::size_t byteIdx = 0; byteIdx != rowSize; ++byteIdx)
+        predictionFunction(byteIdx, above[byteIdx]);
+      break;
+
+    case RawFilter::Average:
+      for(std::size_t byteIdx = 0; byteIdx != left; ++byteIdx)
+        predictionFunction(byteIdx, above[byteIdx] / 2);
+      for(std::size_t byteIdx = left; byteIdx < rowSize; ++byteIdx)
+        predictionFunction(byteIdx, (row[byteIdx - left] + above[byteIdx]) / 2);
+      break;
+
+    case RawFilter::Paeth:
+      for(std::size_t byteIdx = 0; byteIdx != left; ++byteIdx)
+        predictionFunction(byteIdx, above[byteIdx]);
+      for(std::size_t byteIdx = left; byteIdx < rowSize; ++byteIdx)
+        predictionFunction(byteIdx, paethPredictor(row[byteIdx - left], above[byteIdx], above[byteIdx - left]));
+      break;
+
+    case RawFilter::PreviousFrame:
+      for(std::size_t byteIdx = 0; byteIdx != rowSize; ++byteIdx)
+        predictionFunction(byteIdx, previous[byteIdx]);
+      break;
+  }
+}
+
+
+std::size_t FilteredRawBitmapBlock::maxSize(const BitmapInfo& bitmapInfo) noexcept
+{
+  std::size_t size = 0;
+
+  size += bitmapInfo.height * sizeof(std::uint8_t); // Row filters
+  size += RawBitmapBlock::maxSize(bitmapInfo); // Residuals
+
+  return size;
+}
+
+
+void FilteredRawBitmapBlock::encode(Encoder& encoder, BufferWriter& bufferWriter)
+{
+  BufferWriter internalBufferWriter(encoder.internalBuffer_.data(), encoder.internalBuffer_.size());
+
+  const auto rowSize = encoder.bitmapInfo_.width * sizeof(Color);
+  auto bitmap = reinterpret_cast<const std::uint8_t*>(encoder.frameBitmap_.data());
+  auto previousBitmap = reinterpret_cast<const std::uint8_t*>(encoder.previousFrameBitmap_.data());
+
+  // Single filter for the whole frame, picked on sampled rows, costs far
+  // less than picking one for each row and gives up little. The one leaving
+  // the smallest sum of residuals taken as signed bytes wins, the heuristic
+  // PNG encoders commonly use.
+  std::array<std::size_t, rawFilterCount> filterCosts {};
+
+  if(!encoder.previousFrameValid_)
+    filterCosts[static_cast<std::size_t>(RawFilter::PreviousFrame)] = std::numeric_limits<std::size_t>::max();
+
+  for(std::size_t y = 1; y < encoder.bitmapInfo_.height; y += Encoder::rawFilterSampleStep)
+  {
+    auto row = bitmap + y * rowSize;
+
+    for(std::size_t filterIdx = 0; filterIdx != rawFilterCount; ++filterIdx)
+    {
+      auto& cost = filterCosts[filterIdx];
+
+      if(cost == std::numeric_limits<std::size_t>::max())
+        continue;
+
+      forEachPrediction(static_cast<RawFilter>(filterIdx), row, row - rowSize, previousBitmap + y * rowSize, rowSize,
+        [&](std::size_t byteIdx, std::uint8_t prediction)
+        {
+          cost += std::abs(static_cast<std::int8_t>(row[byteIdx] - prediction));
+        }
+      );
+    }
+  }
+
+  auto frameFilter = static_cast<RawFilter>(std::min_element(filterCosts.begin(), filterCosts.end()) - filterCosts.begin());
+
+  for(std::size_t y = 0; y != encoder.bitmapInfo_.height; ++y)
+  {
+    auto row = bitmap + y * rowSize;
+    auto above = (y != 0) ? row - rowSize : nullptr;
+    auto filter = (y == 0 && usesRowAbove(frameFilter)) ? RawFilter::Sub : frameFilter;
+
+    internalBufferWriter.writeUInt8(static_cast<std::uint8_t>(filter));
+
+    auto residuals = reinterpret_cast<std::uint8_t*>(internalBufferWriter.data() + internalBufferWriter.offset());
+    internalBufferWriter.advance(rowSize);
+
+    forEachPrediction(filter, row, above, previousBitmap + y * rowSize, rowSize,
+      [&](std::size_t byteIdx, std::uint8_t prediction)
+      {
+        residuals[byteIdx] = static_cast<std::uint8_t>(row[byteIdx] - prediction);
+      }
+    );
+  }
+
+  encoder.compressBuffer(bufferWriter, internalBufferWriter.data(), internalBufferWriter.offset());
+}
+
+
+void FilteredRawBitmapBlock::decode(Decoder& decoder, BufferReader& bufferReader)
+{
+  decoder.decompressBuffer(bufferReader, decoder.internalBuffer_.data(), decoder.internalBuffer_.size());
+  BufferReader internalBufferReader(decoder.internalBuffer_.data(), decoder.internalBuffer_.size());
+
+  const auto rowSize = decoder.bitmapInfo_.width * sizeof(Color);
+  auto bitmap = reinterpret_cast<std::uint8_t*>(decoder.frame_);
+  auto previousBitmap = reinterpret_cast<const std::uint8_t*>(decoder.previousFrame_);
+
+  // Frame may be decoded over the previous one, each byte of it is read
+  // before being overwritten.
+  for(std::size_t y = 0; y != decoder.bitmapInfo_.height; ++y)
+  {
+    auto filter = static_cast<RawFilter>(internalBufferReader.readUInt8());
+
+    if(static_cast<std::size_t>(filter) >= rawFilterCount || (y == 0 && usesRowAbove(filter)))
+      throw std::runtime_error("Invalid raw bitmap filter.");
+
+    auto residuals = reinterpret_cast<const std::uint8_t*>(internalBufferReader.data() + internalBufferReader.offset());
+    internalBufferReader.advance(rowSize);
+
+    auto row = bitmap + y * rowSize;
+    auto above = (y != 0) ? row - rowSize : nullptr;
+
+    forEachPrediction(filter, row, above, previousBitmap + y * rowSize, rowSize,
+      [&](std::size_t byteIdx, std::uint8_t prediction)
+      {
+        row[byteIdx] = static_cast<std::uint8_t>(residuals[byteIdx] + prediction);
+      }
+    );
+
+    if(decoder.writesOutputBitmap())
+      decoder.writeOutputBitmap(decoder.frame_, y * decoder.bitmapInfo_.width, decoder.bitmapInfo_.width);
+  }
+}
+
+
+std::size_t PlanarRawBitmapBlock::maxSize(const BitmapInfo& bitmapInfo) noexcept
+{
+  return RawBitmapBlock::maxSize(bitmapInfo);
+}
+
+
+void PlanarRawBitmapBlock::encode(Encoder& encoder, BufferWriter& bufferWriter)
+{
+  const auto& bitmap = encoder.blockBitmap();
+  auto planes = encoder.internalBuffer_.data();
+
+  splitColorPlanes(reinterpret_cast<const std::byte*>(bitmap.data()), bitmap.size(), planes, planes + bitmap.size(), planes + 2 * bitmap.size());
+
+  encoder.compressBuffer(bufferWriter, planes, bitmap.size() * sizeof(Color));
+}
+
+
+void PlanarRawBitmapBlock::decode(Decoder& decoder, BufferReader& bufferReader)
+{
+  auto bitmap = decoder.blockBitmap();
+  auto planes = decoder.internalBuffer_.data();
+
+  decoder.decompressBuffer(bufferReader, planes, bitmap.size * sizeof(Color));
+
+  // Merged in chunks, so that output bitmap is written while they're in cache.
+  for(std::size_t chunkOffset = 0; chunkOffset < bitmap.size; chunkOffset += indexChunkSize)
+  {
+    auto chunkSize = std::min(indexChunkSize, bitmap.size - chunkOffset);
+
+    mergeColorPlanes(planes + chunkOffset, planes + bitmap.size + chunkOffset, planes + 2 * bitmap.size + chunkOffset, chunkSize,
+                     reinterpret_cast<std::byte*>(bitmap.data + chunkOffset));
+
+    if(decoder.writesOutputBitmap())
+      decoder.writeOutputBitmap(bitmap.data, chunkOffset, chunkSize);
+  }
+}
+
+
+static std::size_t safeInternalOutpuBufferSize(const BitmapInfo& bitmapInfo) noexcept
+{
+  return std::max({ PaletteBlock::maxSize(), IndexedBitmapBlock::maxSize(bitmapInfo), IndexedResidualBitmapBlock::maxSize(bitmapInfo), ScrollBlock::maxSize(bitmapInfo), WideIndexedBitmapBlock::maxSize(bitmapInfo), FilteredRawBitmapBlock::maxSize(bitmapInfo), PlanarRawBitmapBlock::maxSize(bitmapInfo) });
+}
+
+
+Dictionary::Dictionary(const std::byte* data, std::size_t size) :
+  data_(data, data + size)
+{
+  zstdDDict_.reset(ZSTD_createDDict(data_.data(), data_.size()));
+
+  if(!zstdDDict_)
+    throw std::runtime_error("Failed to load dictionary.");
+}
+
+
+const std::byte* Dictionary::data() const noexcept
+{
+  return data_.data();
+}
+
+
+std::size_t Dictionary::size() const noexcept
+{
+  return data_.size();
+}
+
+
+FrameStats& FrameStats::operator+=(const FrameStats& other) noexcept
+{
+  frameCount += other.frameCount;
+  keyFrameCount += other.keyFrameCount;
+  size += other.size;
+
+  for(std::size_t blockId = 0; blockId != blockTypeCount; ++blockId)
+  {
+    blockCounts[blockId] += other.blockCounts[blockId];
+    blockSizes[blockId] += other.blockSizes[blockId];
+  }
+
+  paletteSize = other.paletteSize;
+  paletteBits = other.paletteBits;
+
+  analysisTime += other.analysisTime;
+  packingTime += other.packingTime;
+  zstdTime += other.zstdTime;
+  totalTime += other.totalTime;
+
+  return *this;
+}
+
+
+Encoder::Encoder(const BitmapInfo& bitmapInfo, const EncoderSettings& settings) :
+  settings_(settings),
+  bitmapInfo_(bitmapInfo),
+  frameBitmap_(bitmapInfo_.width * bitmapInfo_.height),
+  previousFrameBitmap_(bitmapInfo_.width * bitmapInfo_.height),
+  dirtyTiles_(tileCount(bitmapInfo_, dirtyTileSize, dirtyTileSize)),
+  internalBuffer_(safeInternalOutpuBufferSize(bitmapInfo))
+{
+  if(settings_.frameTimeBudget > 0 && settings_.zstdWorkerCount <= 0)
+    throw std::invalid_argument("Frame time budget requires zstd workers.");
+
+  tileBitmap_.reserve(frameBitmap_.size());
+
+  if(settings_.useResidual)
+  {
+    trialBuffer_.resize(sizeof(std::uint32_t) + ZSTD_compressBound(IndexedBitmapBlock::maxSize(bitmapInfo_)));
+    streamHistory_.reserve(IndexedBitmapBlock::maxSize(bitmapInfo_));
+    zstdTrialCompressor_.reset(ZSTD_createCCtx());
+  }
+
+  if(settings_.scrollSearchRadius > 0)
+  {
+    scrolledFrameBitmap_.resize(frameBitmap_.size());
+
+    for(auto& projection : rowProjections_)
+      projection.resize(bitmapInfo_.height);
+
+    for(auto& projection : columnProjections_)
+      projection.resize(bitmapInfo_.width);
+  }
+
+  compressionLevel_ = settings_.zstdCompressionLevel;
+
+  if(settings_.frameTimeBudget > 0)
+    compressionLevel_ = std::min(compressionLevel_, minAdaptiveCompressionLevel);
+
+  streamCompressionLevel_ = compressionLevel_;
+
+  zstdCompressor_.reset(ZSTD_createCCtx());
+  ZSTD_CCtx_setParameter(zstdCompressor_.get(), ZSTD_c_compressionLevel, streamCompressionLevel_);
+  // zstd built without multithreading can't have workers. Compression goes
+  // on in the calling thread then, which adaptive level can't work with.
+  if(ZSTD_isError(ZSTD_CCtx_setParameter(zstdCompressor_.get(), ZSTD_c_nbWorkers, settings_.zstdWorkerCount)) &&
+     settings_.frameTimeBudget > 0)
+  {
+    throw std::runtime_error("Frame time budget requires zstd with multithreading support.");
+  }
+
+  // Window size is chosen once per stream, by the level used at its start.
+  if(settings_.frameTimeBudget > 0)
+    ZSTD_CCtx_setParameter(zstdCompressor_.get(), ZSTD_c_windowLog, adaptiveWindowLog);
+
+  // Referenced dictionary survives session resets done on key frames.
+  // Prepared dictionary would impose its own level at the start of each
+  // stream, so adaptive level gets one prepared by zstd on first use.
+  if(settings_.dictionary && settings_.frameTimeBudget > 0)
+  {
+    if(ZSTD_isError(ZSTD_CCtx_loadDictionary(zstdCompressor_.get(), settings_.dictionary->data(), settings_.dictionary->size())))
+      throw std::runtime_error("Failed to load dictionary.");
+  }
+  else if(settings_.dictionary)
+  {
+    zstdDictionary_.reset(ZSTD_createCDict(settings_.dictionary->data(), settings_.dictionary->size(), settings_.zstdCompressionLevel));
+
+    if(!zstdDictionary_)
+      throw std::runtime_error("Failed to load dictionary.");
+
+    ZSTD_CCtx_refCDict(zstdCompressor_.get(), zstdDictionary_.get());
+  }
+}
+
+
+Encoder::EncodeResult Encoder::encode(const std::byte* bitmap, std::ptrdiff_t pitch, PixelFormat pixelFormat, std::byte* outputBuffer, bool keyFrame)
+{
+  switch(pixelFormat)
+  {
+    case PixelFormat::RGB24:
+      return encode(FormattedBitmap<PixelFormat::RGB24>{ bitmap, pitch }, outputBuffer, keyFrame);
+
+    case PixelFormat::BGR24:
+      return encode(FormattedBitmap<PixelFormat::BGR24>{ bitmap, pitch }, outputBuffer, keyFrame);
+
+    case PixelFormat::RGBX32:
+      return encode(FormattedBitmap<PixelFormat::RGBX32>{ bitmap, pitch }, outputBuffer, keyFrame);
+
+    case PixelFormat::BGRX32:
+      return encode(FormattedBitmap<PixelFormat::BGRX32>{ bitmap, pitch }, outputBuffer, keyFrame);
+
+    case PixelFormat::RGB565:
+      return encode(FormattedBitmap<PixelFormat::RGB565>{ bitmap, pitch }, outputBuffer, keyFrame);
+
+    case PixelFormat::RGBA32:
+      return encode(FormattedBitmap<PixelFormat::RGBA32>{ bitmap, pitch }, outputBuffer, keyFrame);
+
+    case PixelFormat::BGRA32:
+      return encode(FormattedBitmap<PixelFormat::BGRA32>{ bitmap, pitch }, outputBuffer, keyFrame);
+  }
+
+  throw std::invalid_argument("Invalid pixel format.");
+}
+
+
+void Encoder::packFrame(const Color* bitmap, bool keyFrame, PackedFrame& packedFrame)
+{
+  // Compression of the frame packed here before is the latest one known to
+  // be finished, the level follows its time.
+  if(settings_.frameTimeBudget > 0 && packedFrame.compressionTime > 0 && !packedFrame.frameType.nullFrame)
+    adjustCompressionLevel(packedFrame.compressionTime);
+
+  packedFrame.blocks.resize(safeOutputBufferSize());
+  packedFrame.payloadData.clear();
+  packedFrame.payloads.clear();
+  packedFrame.resetStream = false;
+  packedFrame.compressionTime = 0;
+
+  BufferWriter bufferWriter(packedFrame.blocks.data(), packedFrame.blocks.size());
+
+  packedFrame_ = &packedFrame;
+
+  try
+  {
+    packedFrame.frameType = writeFrame(bitmap, bufferWriter, keyFrame);
+  }
+  catch(...)
+  {
+    packedFrame_ = nullptr;
+    throw;
+  }
+
+  packedFrame_ = nullptr;
+  packedFrame.blocksSize = bufferWriter.offset();
+  packedFrame.compressionLevel = compressionLevel_;
+}
+
+
+Encoder::EncodeResult Encoder::compressFrame(PackedFrame& packedFrame, std::byte* outputBuffer)
+{
+  Stopwatch stopwatch(settings_.frameTimeBudget > 0);
+  BufferWriter bufferWriter(outputBuffer, safeOutputBufferSize());
+  auto payloadData = packedFrame.payloadData.data();
+  std::size_t blockOffset = 0;
+
+  auto copyBlocks = [&](std::size_t size)
+  {
+    auto destination = bufferWriter.data() + bufferWriter.offset();
+
+    bufferWriter.advance(size);
+    std::memcpy(destination, packedFrame.blocks.data() + blockOffset, size);
+    blockOffset += size;
+  };
+
+  if(packedFrame.resetStream)
+    ZSTD_CCtx_reset(zstdCompressor_.get(), ZSTD_reset_session_only);
+
+  if(settings_.frameTimeBudget > 0)
+    applyCompressionLevel(packedFrame.compressionLevel);
+
+  for(const auto& payload : packedFrame.payloads)
+  {
+    copyBlocks(payload.blockOffset - blockOffset);
+    compressStream(bufferWriter, payloadData, payload.size);
+    payloadData += payload.size;
+  }
+
+  copyBlocks(packedFrame.blocksSize - blockOffset);
+
+  packedFrame.compressionTime = stopwatch.elapsed();
+
+  return { bufferWriter.offset(), packedFrame.frameType.keyFrame };
+}
+
+
+std::size_t Encoder::safeOutputBufferSize() const noexcept
+{
+  auto fullBlockSize = [](std::size_t blockSize)
+  {
+    return sizeof(std::uint8_t) + // Block type id
+           blockSize;             // Block data
+  };
+
+  auto compressedBlockSize = [](std::size_t blockSize)
+  {
+    return sizeof(std::uint32_t) +        // Compressed block size
+           ZSTD_compressBound(blockSize); // Block data 
+  };
+
+  const auto indexedBitmapWithPaletteSize = std::max(fullBlockSize(compressedBlockSize(PaletteResetBlock::maxSize())), fullBlockSize(PaletteRecallBlock::maxSize())) +
+                                            std::max(fullBlockSize(compressedBlockSize(PaletteBlock::maxSize())), fullBlockSize(PaletteOrderBlock::maxSize())) +
+                                            fullBlockSize(compressedBlockSize(std::max(IndexedBitmapBlock::maxSize(bitmapInfo_), IndexedResidualBitmapBlock::maxSize(bitmapInfo_))));
+
+  const auto wideIndexedBitmapSize = fullBlockSize(WidePaletteBlock::maxSize()) +
+                                     fullBlockSize(compressedBlockSize(WideIndexedBitmapBlock::maxSize(bitmapInfo_)));
+
+  const auto rawBitmapSize = fullBlockSize(compressedBlockSize(std::max({ RawBitmapBlock::maxSize(bitmapInfo_), FilteredRawBitmapBlock::maxSize(bitmapInfo_), PlanarRawBitmapBlock::maxSize(bitmapInfo_) })));
+
+  const auto solidColorBitmapSize = fullBlockSize(SolidColorBitmapBlock::maxSize());
+
+  const auto dirtyTilesSize = fullBlockSize(DirtyTilesBlock::maxSize(bitmapInfo_));
+
+  return fullBlockSize(KeyFrameBlock::maxSize()) +
+         fullBlockSize(compressedBlockSize(ScrollBlock::maxSize(bitmapInfo_))) +
+         dirtyTilesSize +
+         std::max({ indexedBitmapWithPaletteSize, wideIndexedBitmapSize, rawBitmapSize, solidColorBitmapSize });
+}
+
+
+void Encoder::enableStats(bool enabled) noexcept
+{
+  statsEnabled_ = enabled;
+}
+
+
+void Encoder::resetStats() noexcept
+{
+  frameStats_ = {};
+  totalStats_ = {};
+}
+
+
+const FrameStats& Encoder::frameStats() const noexcept
+{
+  return frameStats_;
+}
+
+
+const FrameStats& Encoder::totalStats() const noexcept
+{
+  return totalStats_;
+}
+
+
+int Encoder::compressionLevel() const noexcept
+{
+  return compressionLevel_;
+}
+
+
+std::optional<Palette> Encoder::analyzePalette(const Color* bitmap)
+{
+  paletteBuilder_.clear();
+
+  if(!addPaletteColors(bitmap, bitmap + frameBitmap_.size()))
+    return std::nullopt;
+
+  return makePalette();
+}
+
+
+void Encoder::updatePalette(BufferWriter& bufferWriter, const Palette& newPalette)
+{
+  auto newColors = palette_.difference(newPalette);
+
+  if(newColors.size() > 0)
+  {
+    auto newPaletteMaxColorCount = (std::size_t(1) << newPalette.bits());
+
+    if(palette_.size() + newColors.size() > newPaletteMaxColorCount)
+    {
+      if(auto slot = findCachedPalette(newPalette))
+      {
+        writeBlock<PaletteRecallBlock>(bufferWriter, *slot);
+
+        newColors = palette_.difference(newPalette);
+
+        if(newColors.size() > 0)
+          writePaletteColors(bufferWriter, newColors);
+      }
+      else
+      {
+        if(palette_.size() != 0)
+          writeBlock<PaletteResetBlock>(bufferWriter);
+
+        writePaletteColors(bufferWriter, newPalette);
+      }
+    }
+    else
+    {
+      writePaletteColors(bufferWriter, newColors);
+    }
+  }
+}
+
+
+void Encoder::updateWidePalette(BufferWriter& bufferWriter)
+{
+  std::vector<Color> newColors;
+
+  for(std::size_t colorIdx = 0; colorIdx != widePaletteBuilder_.size(); ++colorIdx)
+  {
+    auto packedColor = widePaletteBuilder_.key(colorIdx);
+
+    if(!wideColorMap_.find(packedColor))
+      newColors.push_back(unpackColor(packedColor));
+  }
+
+  if(newColors.empty())
+    return;
+
+  // Index size doesn't depend on the palette size, so colors of earlier
+  // frames are kept until there's no room left for the new ones.
+  if(wideColorMap_.size() + newColors.size() <= WidePaletteBlock::maxColorCount)
+  {
+    writeBlock<WidePaletteBlock>(bufferWriter, newColors, false);
+    return;
+  }
+
+  newColors.clear();
+
+  for(std::size_t colorIdx = 0; colorIdx != widePaletteBuilder_.size(); ++colorIdx)
+    newColors.push_back(unpackColor(widePaletteBuilder_.key(colorIdx)));
+
+  writeBlock<WidePaletteBlock>(bufferWriter, newColors, true);
+}
+
+
+template<PixelFormat Format>
+void Encoder::readFormattedBitmap(const FormattedBitmap<Format>& bitmap, std::size_t offset, std::size_t count, Color* destination) const
+{
+  // Chunks of pixels may span multiple rows.
+  forEachRow(bitmap.data, bitmap.pitch, pixelSize(Format), bitmapInfo_.width, offset, count,
+    [&](const std::byte* row, std::size_t rowOffset, std::size_t rowCount)
+    {
+      convertPixels<Format>(row, rowCount, destination + (rowOffset - offset));
+    }
+  );
+}
+
+
+bool Encoder::addPaletteColors(const Color* begin, const Color* end)
+{
+  // Packed colors never use the most significant byte, so this value cannot
+  // match any pixel.
+  std::uint32_t lastColor = 0xFFFFFFFF;
+
+  for(auto color = begin; color != end; ++color)
+  {
+    auto packedColor = packColor(*color);
+
+    // Neighbouring pixels tend to share color, skip the table lookup for them.
+    if(packedColor == lastColor)
+      continue;
+
+    lastColor = packedColor;
+
+    if(auto runCount = paletteBuilder_.find(packedColor))
+    {
+      ++*runCount;
+    }
+    else
+    {
+      paletteBuilder_.insert(packedColor, 1);
+
+      if(paletteBuilder_.size() > Palette::maxColorCount)
+        return false;
+    }
+  }
+
+  return true;
+}
+
+
+Palette Encoder::makePalette() const
+{
+  Palette palette(paletteBuilder_.size());
+
+  for(std::size_t colorIdx = 0; colorIdx != palette.size(); ++colorIdx)
+    palette[colorIdx] = unpackColor(paletteBuilder_.key(colorIdx));
+
+  std::sort(palette.begin(), palette.end(), ColorOrdering());
+
+  return palette;
+}
+
+
+bool Encoder::isSceneChange(const FrameAnalysis& frameAnalysis) const
+{
+  if(settings_.maxKeyFrameInterval <= 0 ||
+     frameAnalysis.nullFrame ||
+     keyFrameDistance_ + 1 < static_cast<std::size_t>(std::max(settings_.minKeyFrameInterval, 0)))
+  {
+    return false;
+  }
+
+  // Scene change makes the previous frame and most of the palette useless,
+  // key frame costs little more than any other frame there.
+  if(frameAnalysis.changedPixelCount * sceneChangePixelRatio < frameBitmap_.size())
+    return false;
+
+  if(!frameAnalysis.palette)
+    return true;
+
+  return palette_.difference(*frameAnalysis.palette).size() * sceneChangeColorRatio >= frameAnalysis.palette->size();
+}
+
+
+bool Encoder::residualWins(bool paletteChanged)
+{
+  // Colors added to the palette renumber indices, so indexed bitmap stops
+  // matching the previous one while residual doesn't. Such frames get a
+  // trial of their own.
+  if(!paletteChanged && residualTrialCountdown_ > 0)
+  {
+    --residualTrialCountdown_;
+    return residualPreferred_;
+  }
+
+  // Both bitmaps are compressed against the data zstd has seen last, which
+  // decides how well either of them matches. Output of the trials is dropped.
+  BufferWriter indexedWriter(trialBuffer_.data(), trialBuffer_.size());
+  BufferWriter residualWriter(trialBuffer_.data(), trialBuffer_.size());
+
+  trialCompression_ = true;
+  IndexedBitmapBlock().encode(*this, indexedWriter);
+  IndexedResidualBitmapBlock().encode(*this, residualWriter);
+  trialCompression_ = false;
+
+  auto residualWins = (residualWriter.offset() < indexedWriter.offset());
+
+  if(!paletteChanged)
+  {
+    residualPreferred_ = residualWins;
+    residualTrialCountdown_ = residualTrialInterval - 1;
+  }
+
+  return residualWins;
+}
+
+
+std::size_t Encoder::findDirtyTiles()
+{
+  Stopwatch stopwatch(statsEnabled_);
+  std::size_t dirtyTileCount = 0;
+
+  forEachTile(bitmapInfo_, dirtyTileSize, dirtyTileSize,
+    [&](std::size_t tileIdx, std::size_t x, std::size_t y, std::size_t width, std::size_t height)
+    {
+      auto offset = y * bitmapInfo_.width + x;
+      auto dirty = false;
+
+      for(; height != 0 && !dirty; --height, offset += bitmapInfo_.width)
+        dirty = std::memcmp(frameBitmap_.data() + offset, previousFrameBitmap_.data() + offset, width * sizeof(Color)) != 0;
+
+      dirtyTiles_[tileIdx] = dirty;
+      dirtyTileCount += dirty;
+    }
+  );
+
+  if(statsEnabled_)
+    frameStats_.analysisTime += stopwatch.elapsed();
+
+  return dirtyTileCount;
+}
+
+
+std::optional<Encoder::Scroll> Encoder::findScroll()
+{
+  // Projections narrow the search down to a single candidate per axis, only
+  // candidates are compared pixel by pixel.
+  Stopwatch stopwatch(statsEnabled_);
+
+  // Projections of the previous frame are kept from the last search.
+  computeProjections(bitmapInfo_, frameBitmap_.data(), rowProjections_[0].data(), columnProjections_[0].data());
+
+  if(!previousProjectionsValid_)
+    computeProjections(bitmapInfo_, previousFrameBitmap_.data(), rowProjections_[1].data(), columnProjections_[1].data());
+
+  auto radius = std::min<int>(settings_.scrollSearchRadius, std::numeric_limits<std::int16_t>::max());
+  auto x = findProjectionShift(columnProjections_[0], columnProjections_[1], radius);
+  auto y = findProjectionShift(rowProjections_[0], rowProjections_[1], radius);
+
+  // Frame becomes the previous one whether it's scrolled or not. Null frames
+  // leave both intact, see encode().
+  std::swap(rowProjections_[0], rowProjections_[1]);
+  std::swap(columnProjections_[0], columnProjections_[1]);
+  previousProjectionsValid_ = true;
+
+  std::optional<Scroll> bestScroll;
+
+  if(x == 0 && y == 0)
+  {
+    if(statsEnabled_)
+      frameStats_.analysisTime += stopwatch.elapsed();
+
+    return bestScroll;
+  }
+
+  // Bitmap blocks other than these code the whole frame regardless of the
+  // previous one. Scroll pays off with them only if its exposed pixels are
+  // the only change.
+  auto codesChanges = settings_.useResidual || settings_.useDirtyTiles || settings_.useRawFilters;
+  auto changedPixelCount = countChangedPixels(0, 0);
+
+  auto tryScroll = [&](int scrollX, int scrollY)
+  {
+    auto scroll = Scroll{ scrollX, scrollY, countChangedPixels(scrollX, scrollY), exposedPixelCount(bitmapInfo_, scrollX, scrollY) };
+    auto codedPixelCount = scroll.changedPixelCount + scroll.exposedPixelCount;
+
+    if((codesChanges || scroll.changedPixelCount == 0) &&
+       codedPixelCount * scrollPixelRatio <= changedPixelCount &&
+       (!bestScroll || codedPixelCount < bestScroll->changedPixelCount + bestScroll->exposedPixelCount))
+    {
+      bestScroll = scroll;
+    }
+  };
+
+  tryScroll(x, y);
+
+  // Projections along one axis are slightly disturbed by motion along the
+  // other one, single axis scroll is far more common.
+  if(x != 0 && y != 0)
+  {
+    tryScroll(x, 0);
+    tryScroll(0, y);
+  }
+
+  if(statsEnabled_)
+    frameStats_.analysisTime += stopwatch.elapsed();
+
+  return bestScroll;
+}
+
+
+Palette Encoder::orderColors(const Palette& colors) const
+{
+  // Frequent colors come first. Runs are counted rather than pixels, which
+  // is close enough and comes for free with the palette.
+  auto orderedColors = colors;
+
+  auto runCount = [this](const Color& color)
+  {
+    return *paletteBuilder_.find(packColor(color));
+  };
+
+  std::stable_sort(orderedColors.begin(), orderedColors.end(),
+    [&](const Color& lhs, const Color& rhs)
+    {
+      return runCount(lhs) > runCount(rhs);
+    }
+  );
+
+  return orderedColors;
+}
+
+
+void Encoder::writePaletteColors(BufferWriter& bufferWriter, const Palette& colors)
+{
+  if(settings_.useOrderedPalette)
+    writeBlock<PaletteOrderBlock>(bufferWriter, orderColors(colors));
+  else
+    writeBlock<PaletteBlock>(bufferWriter, colors);
+}
+
+
+std::optional<std::size_t> Encoder::findCachedPalette(const Palette& newPalette) const
+{
+  if(!settings_.usePaletteCache)
+    return std::nullopt;
+
+  // Cached palette qualifies if it can take the missing colors without
+  // widening the indices. The one missing the fewest colors wins, as long as
+  // sending those is cheaper than sending the whole new palette.
+  const auto newPaletteMaxColorCount = (std::size_t(1) << newPalette.bits());
+  std::optional<std::size_t> bestSlot;
+  auto bestNewColorCount = newPalette.size();
+
+  for(std::size_t slot = 0; slot != PaletteCache::slotCount; ++slot)
+  {
+    const auto& palette = paletteCache_.palette(slot);
+
+    if(palette.size() == 0)
+      continue;
+
+    auto newColorCount = palette.difference(newPalette).size();
+
+    if(palette.size() + newColorCount <= newPaletteMaxColorCount &&
+       newColorCount < bestNewColorCount)
+    {
+      bestSlot = slot;
+      bestNewColorCount = newColorCount;
+    }
+  }
+
+  return bestSlot;
+}
+
+
+bool Encoder::makeWidePalette()
+{
+  std::uint32_t lastColor = 0xFFFFFFFF; // See addPaletteColors.
+
+  widePaletteBuilder_.clear();
+
+  for(const auto& color : frameBitmap_)
+  {
+    auto packedColor = packColor(color);
+
+    if(packedColor == lastColor)
+      continue;
+
+    lastColor = packedColor;
+
+    if(widePaletteBuilder_.find(packedColor))
+      continue;
+
+    if(widePaletteBuilder_.size() == WidePaletteBlock::maxColorCount)
+      return false;
+
+    widePaletteBuilder_.insert(packedColor, 0);
+  }
+
+  return true;
+}
+
+
+bool Encoder::prefersPlanarRaw() const
+{
+  // Runs of the same color make long matches in interleaved pixels, without
+  // them zstd does better with bytes of each plane next to each other.
+  const auto& bitmap = blockBitmap();
+  std::size_t sampleCount = 0;
+  std::size_t runCount = 0;
+
+  for(std::size_t rowOffset = 0; rowOffset < bitmap.size(); rowOffset += planarRawSampleStep * bitmapInfo_.width)
+  {
+    auto rowEnd = std::min(rowOffset + bitmapInfo_.width, bitmap.size());
+
+    for(auto pixelIdx = rowOffset + 1; pixelIdx < rowEnd; ++pixelIdx)
+      runCount += (packColor(bitmap[pixelIdx]) == packColor(bitmap[pixelIdx - 1]));
+
+    sampleCount += rowEnd - rowOffset;
+  }
+
+  return runCount * planarRawRunRatio < sampleCount;
+}
+
+
+std::size_t Encoder::countChangedPixels(int scrollX, int scrollY) const
+{
+  // Pixels exposed by a scroll are coded by ScrollBlock, they aren't counted.
+  const auto scrolled = (scrollX != 0 || scrollY != 0);
+  std::size_t changedPixelCount = 0;
+
+  forEachScrolledSegment(bitmapInfo_, scrollX, scrollY,
+    [&](std::size_t offset, std::size_t sourceOffset, std::size_t count)
+    {
+      if(scrolled && offset == sourceOffset)
+        return;
+
+      auto pixel = frameBitmap_.data() + offset;
+      auto previousPixel = previousFrameBitmap_.data() + sourceOffset;
+
+      if(std::memcmp(pixel, previousPixel, count * sizeof(Color)) == 0)
+        return;
+
+      for(std::size_t idx = 0; idx != count; ++idx)
+        changedPixelCount += (packColor(pixel[idx]) != packColor(previousPixel[idx]));
+    }
+  );
+
+  return changedPixelCount;
+}
+
+
+const std::vector<Color>& Encoder::blockBitmap() const noexcept
+{
+  // Tile bitmap is filled by DirtyTilesBlock only.
+  return tileBitmap_.empty() ? frameBitmap_ : tileBitmap_;
+}
+
+
+void Encoder::compressBuffer(BufferWriter& bufferWriter, const std::byte* inputBuffer, std::size_t inputBufferSize)
+{
+  if(trialCompression_)
+  {
+    Stopwatch stopwatch(statsEnabled_);
+    auto compressedSizeOffset = bufferWriter.writeUInt32(0); // Placeholder for compressed data size. Set after compression is finished.
+
+    // Trial leaves the stream alone, recent stream input stands in for its
+    // history.
+    ZSTD_CCtx_setParameter(zstdTrialCompressor_.get(), ZSTD_c_compressionLevel, compressionLevel_);
+    ZSTD_CCtx_refPrefix(zstdTrialCompressor_.get(), streamHistory_.data(), streamHistory_.size());
+
+    auto result = ZSTD_compress2(zstdTrialCompressor_.get(), bufferWriter.data() + bufferWriter.offset(), bufferWriter.size() - bufferWriter.offset(), inputBuffer, inputBufferSize);
+
+    if(ZSTD_isError(result))
+      throw std::runtime_error(std::string("Compression failed: ") + ZSTD_getErrorName(result));
+
+    bufferWriter.overwriteUInt32(compressedSizeOffset, result);
+    bufferWriter.advance(result);
+
+    if(statsEnabled_)
+      frameStats_.zstdTime += stopwatch.elapsed();
+
+    return;
+  }
+
+  if(packedFrame_)
+  {
+    packedFrame_->payloads.push_back({ bufferWriter.offset(), inputBufferSize });
+    packedFrame_->payloadData.insert(packedFrame_->payloadData.end(), inputBuffer, inputBuffer + inputBufferSize);
+  }
+  else
+  {
+    compressStream(bufferWriter, inputBuffer, inputBufferSize);
+  }
+
+  // Last frame worth of input is kept for trial compressions.
+  if(settings_.useResidual)
+  {
+    auto historySize = std::min(inputBufferSize, streamHistory_.capacity());
+    auto keptSize = std::min(streamHistory_.size(), streamHistory_.capacity() - historySize);
+
+    streamHistory_.erase(streamHistory_.begin(), streamHistory_.end() - keptSize);
+    streamHistory_.insert(streamHistory_.end(), inputBuffer + inputBufferSize - historySize, inputBuffer + inputBufferSize);
+  }
+}
+
+
+void Encoder::compressStream(BufferWriter& bufferWriter, const std::byte* inputBuffer, std::size_t inputBufferSize)
+{
+  Stopwatch stopwatch(statsEnabled_);
+  auto compressedSizeOffset = bufferWriter.writeUInt32(0); // Placeholder for compressed data size. Set after compression is finished.
+
+  ZSTD_inBuffer zstdInput = { inputBuffer, inputBufferSize, 0 };
+  ZSTD_outBuffer zstdOutput = { bufferWriter.data() + bufferWriter.offset(), bufferWriter.size() - bufferWriter.offset(), 0 };
+  std::size_t result = 0;
+
+  // Flush is complete once nothing is left buffered, which may take more
+  // calls than consuming the input.
+  do
+  {
+    result = ZSTD_compressStream2(zstdCompressor_.get(), &zstdOutput , &zstdInput, ZSTD_e_flush);
+
+    if(ZSTD_isError(result))
+      throw std::runtime_error(std::string("Compression failed: ") + ZSTD_getErrorName(result));
+  }
+  while(result != 0);
+
+  bufferWriter.overwriteUInt32(compressedSizeOffset, zstdOutput.pos);
+  bufferWriter.advance(zstdOutput.pos);
+
+  if(statsEnabled_)
+    frameStats_.zstdTime += stopwatch.elapsed();
+}
+
+
+void Encoder::resetPalette()
+{
+  palette_.clear();
+  colorMap_.clear();
+  previousFrameInPalette_ = false;
 }
 
 
 void Encoder::reset()
 {
   resetPalette();
-  previousFrameBitmap_.clear();
-  ZSTD_CCtx_reset(zstdCompressor_.get(), ZSTD_reset_session_only);
+  paletteCache_.clear();
+  wideColorMap_.clear();
+  previousFrameValid_ = false;
+  previousProjectionsValid_ = false;
+  residualTrialCountdown_ = 0;
+  streamHistory_.clear();
+
+  if(packedFrame_)
+    packedFrame_->resetStream = true;
+  else
+    ZSTD_CCtx_reset(zstdCompressor_.get(), ZSTD_reset_session_only);
+}
+
+
+void Encoder::updateStats(std::size_t frameSize, bool keyFrame, std::uint64_t totalTime)
+{
+  frameStats_.frameCount = 1;
+  frameStats_.keyFrameCount = keyFrame;
+  frameStats_.size = frameSize;
+  frameStats_.paletteSize = palette_.size();
+  frameStats_.paletteBits = palette_.bits();
+  frameStats_.totalTime = totalTime;
+
+  totalStats_ += frameStats_;
+}
+
+
+void Encoder::adjustCompressionLevel(std::uint64_t frameTime)
+{
+  // Level goes up by one once frames leave at least a fifth of the budget
+  // unused. It goes down right after a frame exceeds the budget, halfway to
+  // the lowest level if it exceeds it by more than a quarter. Raised level
+  // failing right away is only reverted, first frames after zstd switches to
+  // a stronger strategy take much longer than the following ones. New level
+  // is passed to zstd by applyCompressionLevel().
+  const auto frameTimeBudget = static_cast<std::uint64_t>(settings_.frameTimeBudget) * 1000;
+  const auto minLevel = std::min(minAdaptiveCompressionLevel, settings_.zstdCompressionLevel);
+  auto level = compressionLevel_;
+
+  if(frameTime > frameTimeBudget)
+  {
+    if(compressionLevelRaised_)
+    {
+      level -= 1;
+      levelHoldLength_ = std::min(2 * levelHoldLength_, maxLevelHoldLength);
+    }
+    else
+    {
+      if(frameTime > frameTimeBudget + frameTimeBudget / 4)
+        level -= std::max(1, (level - minLevel + 1) / 2);
+      else
+        level -= 1;
+
+      levelHoldLength_ = minLevelHoldLength;
+    }
+
+    levelHoldFrameCount_ = levelHoldLength_;
+  }
+  else if(levelHoldFrameCount_ > 0)
+  {
+    --levelHoldFrameCount_;
+  }
+  else if(frameTime * 5 < frameTimeBudget * 4)
+  {
+    level += 1;
+  }
+
+  level = std::clamp(level, minLevel, settings_.zstdCompressionLevel);
+  compressionLevelRaised_ = (level > compressionLevel_);
+  compressionLevel_ = level;
+}
+
+
+void Encoder::applyCompressionLevel(int level)
+{
+  // zstd applies new level to data compressed from now on, keeping its
+  // history.
+  if(level != streamCompressionLevel_)
+  {
+    streamCompressionLevel_ = level;
+    ZSTD_CCtx_setParameter(zstdCompressor_.get(), ZSTD_c_compressionLevel, streamCompressionLevel_);
+  }
 }
 
 
-Decoder::Decoder(const BitmapInfo& bitmapInfo) :
+Decoder::Decoder(const BitmapInfo& bitmapInfo, std::shared_ptr<const Dictionary> dictionary) :
   bitmapInfo_(bitmapInfo),
-  frameBitmap_(bitmapInfo_.width * bitmapInfo_.height),
-  internalBuffer_(safeInternalOutpuBufferSize(bitmapInfo))
+  internalBuffer_(safeInternalOutpuBufferSize(bitmapInfo)),
+  dictionary_(std::move(dictionary))
 {
+  tileBitmap_.reserve(pixelCount());
+
   zstdDecompressor_.reset(ZSTD_createDCtx());
+
+  if(dictionary_)
+    ZSTD_DCtx_refDDict(zstdDecompressor_.get(), dictionary_->zstdDDict_.get());
+}
+
+
+Decoder::DecodeResult Decoder::decodeInPlace(const std::byte* inputBuffer, std::size_t inputBufferSize, Color* bitmap)
+{
+  decodeFrame(inputBuffer, inputBufferSize, bitmap);
+
+  // Null frame leaves the previous frame where it was.
+  if(previousFrame_ != bitmap)
+  {
+    std::copy_n(previousFrame_, pixelCount(), bitmap);
+    previousFrame_ = bitmap;
+  }
+
+  return result_;
+}
+
+
+Decoder::DecodeResult Decoder::decode(const std::byte* inputBuffer, std::size_t inputBufferSize, std::byte* bitmap, std::ptrdiff_t pitch, PixelFormat pixelFormat)
+{
+  decodeFrame(inputBuffer, inputBufferSize, ownedBitmap(), { bitmap, pitch, pixelFormat });
+
+  // Null, dirty tile and scrolled frames are built upon the previous one,
+  // they're converted once complete.
+  if(!outputBitmapWritten_)
+    writeOutputBitmap(previousFrame_, 0, pixelCount());
+
+  return result_;
+}
+
+
+void Decoder::enableStats(bool enabled) noexcept
+{
+  statsEnabled_ = enabled;
+}
+
+
+void Decoder::resetStats() noexcept
+{
+  frameStats_ = {};
+  totalStats_ = {};
+}
+
+
+const FrameStats& Decoder::frameStats() const noexcept
+{
+  return frameStats_;
+}
+
+
+const FrameStats& Decoder::totalStats() const noexcept
+{
+  return totalStats_;
+}
+
+
+void Decoder::decodeFrame(const std::byte* inputBuffer, std::size_t inputBufferSize, Color* bitmap, const FormattedBitmap& outputBitmap)
+{
+  Stopwatch stopwatch(statsEnabled_);
+  BufferReader bufferReader(inputBuffer, inputBufferSize);
+
+  if(statsEnabled_)
+    frameStats_ = {};
+
+  result_ = {};
+  tileBitmap_.clear();
+  frameScrolled_ = false;
+  frame_ = bitmap;
+  outputBitmap_ = outputBitmap;
+  outputBitmapWritten_ = false;
+  seekContainerId_ = 0;
+
+  if(previousFrame_ == nullptr)
+    previousFrame_ = bitmap;
+
+  while(bufferReader.offset() != bufferReader.size())
+  {
+    Stopwatch blockStopwatch(statsEnabled_);
+    auto offset = bufferReader.offset();
+    auto zstdTime = frameStats_.zstdTime;
+
+    auto frameBlockId = bufferReader.readUInt8();
+    auto block = make_variant<FrameBlock>(frameBlockId);
+
+    std::visit(
+      [&, this](auto& block)
+      {
+        block.decode(*this, bufferReader);
+      },
+      block
+    );
+
+    if(statsEnabled_)
+    {
+      frameStats_.blockCounts[frameBlockId] += 1;
+      frameStats_.blockSizes[frameBlockId] += bufferReader.offset() - offset;
+      frameStats_.packingTime += blockStopwatch.elapsed() - (frameStats_.zstdTime - zstdTime);
+    }
+  }
+
+  if(!tileBitmap_.empty())
+    applyDirtyTiles();
+
+  // Scrolled frame differs from the one decoded last time, even if nothing
+  // else changed.
+  if(frameScrolled_)
+    result_.nullFrame = false;
+
+  // Decoded frame becomes the previous one. Null frames leave it intact.
+  if(!result_.nullFrame)
+    previousFrame_ = frame_;
+
+  if(statsEnabled_)
+    updateStats(inputBufferSize, stopwatch.elapsed());
 }
 
 
 void Decoder::decompressBuffer(BufferReader& bufferReader, std::byte* outputBuffer, std::size_t outputBufferSize)
 {
+  Stopwatch stopwatch(statsEnabled_);
   auto compressedSize = bufferReader.readUInt32();
 
   ZSTD_inBuffer zstdInput = { bufferReader.data() + bufferReader.offset(), compressedSize, 0 };
   ZSTD_outBuffer zstdOutput = { outputBuffer, outputBufferSize, 0 };
 
   while(zstdInput.pos < zstdInput.size)
-    ZSTD_decompressStream(zstdDecompressor_.get(), &zstdOutput , &zstdInput);
+  {
+    // Errors include dictionary mismatch, which would otherwise never let the
+    // input be consumed.
+    auto result = ZSTD_decompressStream(zstdDecompressor_.get(), &zstdOutput , &zstdInput);
+
+    if(ZSTD_isError(result))
+      throw std::runtime_error(std::string("Decompression failed: ") + ZSTD_getErrorName(result));
+  }
+
+  if(statsEnabled_)
+    frameStats_.zstdTime += stopwatch.elapsed();
+
+  if(dictionaryTrainer_)
+    dictionaryTrainer_->addSample(outputBuffer, zstdOutput.pos);
 
   bufferReader.advance(compressedSize);
 }
 
 
+std::size_t Decoder::pixelCount() const noexcept
+{
+  return bitmapInfo_.width * bitmapInfo_.height;
+}
+
+
+Color* Decoder::ownedBitmap()
+{
+  if(ownedBitmaps_[0].empty())
+  {
+    for(auto& bitmap : ownedBitmaps_)
+      bitmap.resize(pixelCount());
+  }
+
+  // Owned bitmaps take turns, the other one may hold the previous frame.
+  return (ownedBitmaps_[0].data() != previousFrame_) ? ownedBitmaps_[0].data() : ownedBitmaps_[1].data();
+}
+
+
+bool Decoder::ownsBitmap(const Color* bitmap) const noexcept
+{
+  return bitmap != nullptr && (bitmap == ownedBitmaps_[0].data() || bitmap == ownedBitmaps_[1].data());
+}
+
+
+Decoder::BitmapSpan Decoder::blockBitmap() noexcept
+{
+  // Tile bitmap is filled by DirtyTilesBlock only.
+  if(!tileBitmap_.empty())
+    return { tileBitmap_.data(), tileBitmap_.size() };
+
+  return { frame_, pixelCount() };
+}
+
+
+void Decoder::applyDirtyTiles()
+{
+  auto tilePixel = tileBitmap_.cbegin();
+
+  forEachTile(bitmapInfo_, dirtyTileWidth_, dirtyTileHeight_,
+    [&](std::size_t tileIdx, std::size_t x, std::size_t y, std::size_t width, std::size_t height)
+    {
+      auto offset = y * bitmapInfo_.width + x;
+
+      for(; height != 0; --height, offset += bitmapInfo_.width)
+      {
+        if(dirtyTiles_[tileIdx])
+        {
+          std::copy_n(tilePixel, width, frame_ + offset);
+          tilePixel += width;
+        }
+        else if(frame_ != previousFrame_)
+        {
+          std::copy_n(previousFrame_ + offset, width, frame_ + offset);
+        }
+      }
+    }
+  );
+}
+
+
+bool Decoder::writesOutputBitmap() const noexcept
+{
+  // Dirty tiles are scattered over the frame, they're converted afterwards.
+  return outputBitmap_.data != nullptr && tileBitmap_.empty();
+}
+
+
+void Decoder::writeOutputBitmap(const Color* bitmap, std::size_t offset, std::size_t count)
+{
+  forEachRow(outputBitmap_.data, outputBitmap_.pitch, pixelSize(outputBitmap_.pixelFormat), bitmapInfo_.width, offset, count,
+    [&](std::byte* row, std::size_t rowOffset, std::size_t rowCount)
+    {
+      formatPixels(bitmap + rowOffset, rowCount, outputBitmap_.pixelFormat, row);
+    }
+  );
+
+  outputBitmapWritten_ = true;
+}
+
+
+void Decoder::writeOutputBitmap(const std::uint8_t* paletteIndices, const std::byte* formattedPalette, std::size_t offset, std::size_t count)
+{
+  const auto pixelSize = lpvc::pixelSize(outputBitmap_.pixelFormat);
+
+  forEachRow(outputBitmap_.data, outputBitmap_.pitch, pixelSize, bitmapInfo_.width, offset, count,
+    [&](std::byte* row, std::size_t rowOffset, std::size_t rowCount)
+    {
+      auto indices = paletteIndices + (rowOffset - offset);
+
+      switch(pixelSize)
+      {
+        case 2: lookupPixels<2>(indices, rowCount, formattedPalette, row); break;
+        case 3: lookupPixels<3>(indices, rowCount, formattedPalette, row); break;
+        case 4: lookupPixels<4>(indices, rowCount, formattedPalette, row); break;
+      }
+    }
+  );
+
+  outputBitmapWritten_ = true;
+}
+
+
+void Decoder::fillOutputBitmap(const Color& color)
+{
+  const auto pixelSize = lpvc::pixelSize(outputBitmap_.pixelFormat);
+  const auto rowSize = bitmapInfo_.width * pixelSize;
+  auto firstRow = outputBitmap_.data;
+
+  // First row is filled pixel by pixel, the rest are its copies.
+  for(std::size_t x = 0; x != bitmapInfo_.width; ++x)
+    formatPixels(&color, 1, outputBitmap_.pixelFormat, firstRow + x * pixelSize);
+
+  for(std::size_t y = 1; y < bitmapInfo_.height; ++y)
+    std::memcpy(firstRow + static_cast<std::ptrdiff_t>(y) * outputBitmap_.pitch, firstRow, rowSize);
+
+  outputBitmapWritten_ = true;
+}
+
+
 void Decoder::resetPalette()
 {
   palette_.clear();
+  colorMap_.clear();
 }
 
 
 void Decoder::reset()
 {
   resetPalette();
+  paletteCache_.clear();
+  widePalette_.clear();
   ZSTD_DCtx_reset(zstdDecompressor_.get(), ZSTD_reset_session_only);
+
+  // Key frames never refer to the previous frame. Dropping it means a broken
+  // stream can't reach a bitmap the caller no longer keeps.
+  previousFrame_ = frame_;
+}
+
+
+void Decoder::updateStats(std::size_t frameSize, std::uint64_t totalTime)
+{
+  frameStats_.frameCount = 1;
+  frameStats_.keyFrameCount = result_.keyFrame;
+  frameStats_.size = frameSize;
+  frameStats_.paletteSize = palette_.size();
+  frameStats_.paletteBits = palette_.bits();
+  frameStats_.totalTime = totalTime;
+
+  totalStats_ += frameStats_;
 }
 
 
@@ -0,0 +1,245 @@
+#include <lpvc/parallel_decoder.h>
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace lpvc
+{
+
+
+struct ParallelDecoder::Segment
+{
+  std::vector<std::byte> input;
+  std::vector<std::size_t> frameSizes;
+  std::vector<Color> frames;
+  std::vector<Decoder::DecodeResult> results;
+  std::size_t decodedFrameCount = 0;
+  std::size_t deliveredFrameCount = 0;
+  std::exception_ptr error;
+  bool decoded = false;
+};
+
+
+ParallelDecoder::ParallelDecoder(const BitmapInfo& bitmapInfo,
+                                 OutputCallback outputCallback,
+                                 std::size_t threadCount,
+                                 std::shared_ptr<const Dictionary> dictionary) :
+  bitmapInfo_(bitmapInfo),
+  outputCallback_(std::move(outputCallback))
+{
+  if(threadCount == 0)
+    threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+  maxPendingSegmentCount_ = 2 * threadCount;
+
+  decoders_.reserve(threadCount);
+  threads_.reserve(threadCount);
+
+  for(std::size_t threadIdx = 0; threadIdx != threadCount; ++threadIdx)
+    decoders_.emplace_back(bitmapInfo_, dictionary);
+
+  for(auto& decoder : decoders_)
+    threads_.emplace_back(&ParallelDecoder::workerThread, this, std::ref(decoder));
+}
+
+
+ParallelDecoder::~ParallelDecoder()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    segmentQueue_.clear();
+  }
+
+  segmentQueued_.notify_all();
+  frameDelivered_.notify_all();
+
+  for(auto& thread : threads_)
+    thread.join();
+}
+
+
+void ParallelDecoder::decode(const std::byte* inputBuffer, std::size_t inputBufferSize, bool keyFrame)
+{
+  if(currentSegment_ && keyFrame)
+    submitSegment();
+
+  if(!currentSegment_)
+  {
+    if(pendingSegments_.size() == maxPendingSegmentCount_)
+      deliverSegment(true);
+
+    if(freeSegments_.empty())
+    {
+      currentSegment_ = std::make_unique<Segment>();
+      currentSegment_->frames.resize(segmentBufferedFrameCount * bitmapInfo_.width * bitmapInfo_.height);
+      currentSegment_->results.resize(segmentBufferedFrameCount);
+    }
+    else
+    {
+      currentSegment_ = std::move(freeSegments_.back());
+      freeSegments_.pop_back();
+    }
+  }
+
+  currentSegment_->input.insert(currentSegment_->input.end(), inputBuffer, inputBuffer + inputBufferSize);
+  currentSegment_->frameSizes.push_back(inputBufferSize);
+
+  while(deliverSegment(false));
+}
+
+
+void ParallelDecoder::flush()
+{
+  if(currentSegment_)
+    submitSegment();
+
+  while(deliverSegment(true));
+}
+
+
+void ParallelDecoder::submitSegment()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    segmentQueue_.push_back(currentSegment_.get());
+  }
+
+  segmentQueued_.notify_one();
+  pendingSegments_.push_back(std::move(currentSegment_));
+}
+
+
+bool ParallelDecoder::deliverSegment(bool wait)
+{
+  const auto pixelCount = bitmapInfo_.width * bitmapInfo_.height;
+
+  if(pendingSegments_.empty())
+    return false;
+
+  auto& segment = *pendingSegments_.front();
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while(true)
+  {
+    if(wait)
+      frameDecoded_.wait(lock, [&]() { return segment.deliveredFrameCount != segment.decodedFrameCount || segment.decoded; });
+
+    if(segment.deliveredFrameCount == segment.decodedFrameCount)
+      break;
+
+    // Frames are delivered without holding the lock, worker keeps decoding
+    // into other buffers meanwhile.
+    auto frameIdx = segment.deliveredFrameCount % segmentBufferedFrameCount;
+    lock.unlock();
+
+    outputCallback_(segment.frames.data() + frameIdx * pixelCount, segment.results[frameIdx]);
+
+    lock.lock();
+    ++segment.deliveredFrameCount;
+    frameDelivered_.notify_all();
+  }
+
+  if(!segment.decoded)
+    return false;
+
+  lock.unlock();
+
+  auto deliveredSegment = std::move(pendingSegments_.front());
+  pendingSegments_.pop_front();
+
+  auto error = deliveredSegment->error;
+
+  deliveredSegment->input.clear();
+  deliveredSegment->frameSizes.clear();
+  deliveredSegment->decodedFrameCount = 0;
+  deliveredSegment->deliveredFrameCount = 0;
+  deliveredSegment->error = nullptr;
+  deliveredSegment->decoded = false;
+  freeSegments_.push_back(std::move(deliveredSegment));
+
+  if(error)
+    std::rethrow_exception(error);
+
+  return true;
+}
+
+
+void ParallelDecoder::workerThread(Decoder& decoder)
+{
+  const auto pixelCount = bitmapInfo_.width * bitmapInfo_.height;
+
+  while(true)
+  {
+    Segment* segment = nullptr;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      segmentQueued_.wait(lock, [this]() { return stopping_ || !segmentQueue_.empty(); });
+
+      if(stopping_)
+        return;
+
+      segment = segmentQueue_.front();
+      segmentQueue_.pop_front();
+    }
+
+    try
+    {
+      auto input = segment->input.data();
+
+      // Checked up front, the worker's decoder still refers to a frame of
+      // the previous segment, which other threads may be using by now. Key
+      // frames start with KeyFrameBlock (see Encoder::encode).
+      constexpr auto keyFrameBlockId = variant_type_index<KeyFrameBlock, FrameBlock>();
+
+      if(segment->frameSizes.front() == 0 || std::to_integer<std::size_t>(input[0]) != keyFrameBlockId)
+        throw std::runtime_error("Segment does not start with a key frame.");
+
+      for(std::size_t frameIdx = 0; frameIdx != segment->frameSizes.size(); ++frameIdx)
+      {
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          frameDelivered_.wait(lock, [&]() { return stopping_ || frameIdx - segment->deliveredFrameCount < segmentBufferedFrameCount; });
+
+          if(stopping_)
+            return;
+        }
+
+        // Frame buffers form a ring, the previous frame stays intact as the
+        // reference while the next one is decoded.
+        auto bufferIdx = frameIdx % segmentBufferedFrameCount;
+        auto decodeResult = decoder.decodeInPlace(input, segment->frameSizes[frameIdx], segment->frames.data() + bufferIdx * pixelCount);
+
+        segment->results[bufferIdx] = decodeResult;
+        input += segment->frameSizes[frameIdx];
+
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          ++segment->decodedFrameCount;
+        }
+
+        frameDecoded_.notify_all();
+      }
+    }
+    catch(...)
+    {
+      segment->error = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      segment->decoded = true;
+    }
+
+    frameDecoded_.notify_all();
+  }
+}
+
+
+} // namespace lpvc
@@ -0,0 +1,218 @@
+#include <lpvc/parallel_encoder.h>
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace lpvc
+{
+
+
+struct ParallelEncoder::Segment
+{
+  std::vector<Color> frames;
+  std::size_t frameCount = 0;
+  std::vector<std::byte> output;
+  std::vector<Encoder::EncodeResult> frameResults;
+  std::exception_ptr error;
+  bool encoded = false;
+};
+
+
+ParallelEncoder::ParallelEncoder(const BitmapInfo& bitmapInfo,
+                                 const EncoderSettings& settings,
+                                 OutputCallback outputCallback,
+                                 std::size_t threadCount,
+                                 std::size_t segmentLength) :
+  bitmapInfo_(bitmapInfo),
+  outputCallback_(std::move(outputCallback)),
+  segmentLength_(std::max<std::size_t>(segmentLength, 1))
+{
+  if(threadCount == 0)
+    threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+
+  // Bounds memory use while keeping all workers busy.
+  maxPendingSegmentCount_ = 2 * threadCount;
+
+  encoders_.reserve(threadCount);
+  threads_.reserve(threadCount);
+
+  for(std::size_t threadIdx = 0; threadIdx != threadCount; ++threadIdx)
+    encoders_.emplace_back(bitmapInfo_, settings);
+
+  for(auto& encoder : encoders_)
+    threads_.emplace_back(&ParallelEncoder::workerThread, this, std::ref(encoder));
+}
+
+
+ParallelEncoder::~ParallelEncoder()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    segmentQueue_.clear();
+  }
+
+  segmentQueued_.notify_all();
+
+  for(auto& thread : threads_)
+    thread.join();
+}
+
+
+void ParallelEncoder::flush()
+{
+  if(currentSegment_)
+    submitSegment();
+
+  while(deliverSegment(true));
+}
+
+
+Color* ParallelEncoder::beginFrame(bool keyFrame)
+{
+  const auto pixelCount = bitmapInfo_.width * bitmapInfo_.height;
+
+  if(currentSegment_ && keyFrame)
+    submitSegment();
+
+  if(!currentSegment_)
+  {
+    if(pendingSegments_.size() == maxPendingSegmentCount_)
+      deliverSegment(true);
+
+    if(freeSegments_.empty())
+    {
+      currentSegment_ = std::make_unique<Segment>();
+      currentSegment_->frames.resize(segmentLength_ * pixelCount);
+    }
+    else
+    {
+      currentSegment_ = std::move(freeSegments_.back());
+      freeSegments_.pop_back();
+    }
+  }
+
+  return currentSegment_->frames.data() + currentSegment_->frameCount * pixelCount;
+}
+
+
+void ParallelEncoder::endFrame()
+{
+  if(++currentSegment_->frameCount == segmentLength_)
+    submitSegment();
+
+  // Output is passed on as soon as possible, without waiting.
+  while(deliverSegment(false));
+}
+
+
+void ParallelEncoder::submitSegment()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    segmentQueue_.push_back(currentSegment_.get());
+  }
+
+  segmentQueued_.notify_one();
+  pendingSegments_.push_back(std::move(currentSegment_));
+}
+
+
+bool ParallelEncoder::deliverSegment(bool wait)
+{
+  if(pendingSegments_.empty())
+    return false;
+
+  auto& segment = pendingSegments_.front();
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+
+    if(wait)
+      segmentEncoded_.wait(lock, [&]() { return segment->encoded; });
+    else if(!segment->encoded)
+      return false;
+  }
+
+  auto deliveredSegment = std::move(segment);
+  pendingSegments_.pop_front();
+
+  auto error = deliveredSegment->error;
+  auto frame = deliveredSegment->output.data();
+
+  if(!error)
+  {
+    for(const auto& frameResult : deliveredSegment->frameResults)
+    {
+      outputCallback_(frame, frameResult.bytesWritten, frameResult.keyFrame);
+      frame += frameResult.bytesWritten;
+    }
+  }
+
+  deliveredSegment->frameCount = 0;
+  deliveredSegment->output.clear();
+  deliveredSegment->frameResults.clear();
+  deliveredSegment->error = nullptr;
+  deliveredSegment->encoded = false;
+  freeSegments_.push_back(std::move(deliveredSegment));
+
+  if(error)
+    std::rethrow_exception(error);
+
+  return true;
+}
+
+
+void ParallelEncoder::workerThread(Encoder& encoder)
+{
+  const auto pixelCount = bitmapInfo_.width * bitmapInfo_.height;
+  std::vector<std::byte> outputBuffer(encoder.safeOutputBufferSize());
+
+  while(true)
+  {
+    Segment* segment = nullptr;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      segmentQueued_.wait(lock, [this]() { return stopping_ || !segmentQueue_.empty(); });
+
+      if(stopping_)
+        return;
+
+      segment = segmentQueue_.front();
+      segmentQueue_.pop_front();
+    }
+
+    try
+    {
+      // Key frame resets all encoder state left by the previous segment.
+      for(std::size_t frameIdx = 0; frameIdx != segment->frameCount; ++frameIdx)
+      {
+        auto frame = static_cast<const Color*>(segment->frames.data() + frameIdx * pixelCount);
+        auto encodeResult = encoder.encode(frame, outputBuffer.data(), frameIdx == 0);
+
+        segment->output.insert(segment->output.end(), outputBuffer.begin(), outputBuffer.begin() + encodeResult.bytesWritten);
+        segment->frameResults.push_back(encodeResult);
+      }
+    }
+    catch(...)
+    {
+      segment->error = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      segment->encoded = true;
+    }
+
+    segmentEncoded_.notify_all();
+  }
+}
+
+
+} // namespace lpvc
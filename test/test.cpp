@@ -1,11 +1,20 @@
 #define CATCH_CONFIG_MAIN
 
+#include <lpvc/async_encoder.h>
+#include <lpvc/container.h>
+#include <lpvc/dictionary_trainer.h>
 #include <lpvc/lpvc.h>
+#include <lpvc/parallel_decoder.h>
+#include <lpvc/parallel_encoder.h>
 #include <catch2/catch.hpp>
 #include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <filesystem>
+#include <iterator>
+#include <optional>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 
@@ -46,13 +55,40 @@ static void fillBitmap(std::vector<lpvc::Color>& bitmap, std::size_t colorCount)
 }
 
 
+// Settings of a fast encoder with options given by members enabled.
+template<typename ...Options>
+static lpvc::EncoderSettings makeSettings(bool usePalette, Options... options)
+{
+  auto encoderSettings = lpvc::EncoderSettings { usePalette, 1, 1 };
+  ((encoderSettings.*options = true), ...);
+  return encoderSettings;
+}
+
+
+// Same as makeSettings(), with scrolling detected within given radius.
+template<typename ...Options>
+static lpvc::EncoderSettings makeScrollSettings(int scrollSearchRadius, bool usePalette, Options... options)
+{
+  auto encoderSettings = makeSettings(usePalette, options...);
+  encoderSettings.scrollSearchRadius = scrollSearchRadius;
+  return encoderSettings;
+}
+
+
 TEST_CASE("Encoder and decoder results comparison", "")
 {
   auto encoderSettings = GENERATE(
     lpvc::EncoderSettings { true, 1, 1 },
-    lpvc::EncoderSettings { false, 1, 1 }
+    lpvc::EncoderSettings { false, 1, 1 },
+    makeSettings(true, &lpvc::EncoderSettings::useResidual),
+    makeSettings(true, &lpvc::EncoderSettings::useDirtyTiles),
+    makeSettings(false, &lpvc::EncoderSettings::useDirtyTiles),
+    makeScrollSettings(4, true),
+    makeScrollSettings(4, false, &lpvc::EncoderSettings::useResidual, &lpvc::EncoderSettings::useDirtyTiles)
   );
 
+  auto contiguousInput = GENERATE(true, false);
+
   auto bitmapInfo = lpvc::BitmapInfo{17, 17};
   auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
   auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
@@ -64,7 +100,9 @@ TEST_CASE("Encoder and decoder results comparison", "")
   auto inputAndOutputEqual = [&](std::size_t pixelCount, std::size_t colorCount, bool keyFrame)
   {
     fillBitmap(inputBitmap, colorCount);
-    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), keyFrame);
+    auto encodeResult = contiguousInput ?
+                        encoder.encode(static_cast<const lpvc::Color*>(inputBitmap.data()), encoderBuffer.data(), keyFrame) :
+                        encoder.encode(inputBitmap.begin(), encoderBuffer.data(), keyFrame);
     auto decodeResult = decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.data());
 
     assert(inputBitmap == outputBitmap);
@@ -91,3 +129,1293 @@ TEST_CASE("Encoder and decoder results comparison", "")
     }
   }
 }
+
+
+TEST_CASE("Repeated frames are decoded as null frames", "")
+{
+  auto bitmapInfo = lpvc::BitmapInfo{17, 17};
+  auto encoder = lpvc::Encoder(bitmapInfo, lpvc::EncoderSettings { true, 1, 1 });
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapInfo.width * bitmapInfo.height);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapInfo.width * bitmapInfo.height);
+
+  fillBitmap(inputBitmap, 7);
+
+  for(std::size_t frameIdx = 0; frameIdx < 3; ++frameIdx)
+  {
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), false);
+    auto decodeResult = decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.data());
+
+    REQUIRE(decodeResult.nullFrame == (frameIdx != 0));
+    REQUIRE(inputBitmap == outputBitmap);
+  }
+}
+
+
+TEST_CASE("Scrolled frames are decoded correctly", "")
+{
+  auto useDirtyTiles = GENERATE(false, true);
+
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  encoderSettings.useDirtyTiles = useDirtyTiles;
+  encoderSettings.scrollSearchRadius = 8;
+
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapInfo.width * bitmapInfo.height);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapInfo.width * bitmapInfo.height);
+
+  auto fillScrolledBitmap = [&](int scrollX, int scrollY)
+  {
+    for(std::size_t y = 0; y < bitmapInfo.height; ++y)
+    {
+      for(std::size_t x = 0; x < bitmapInfo.width; ++x)
+      {
+        auto u = static_cast<unsigned int>(static_cast<int>(x) - scrollX + 100);
+        auto v = static_cast<unsigned int>(static_cast<int>(y) - scrollY + 100);
+        inputBitmap[y * bitmapInfo.width + x] = makeColor((u * 37 + v * 11) % 251, (u * v) % 7 * 30, v % 5 * 50);
+      }
+    }
+  };
+
+  const std::pair<int, int> scrolls[] = { {0, 0}, {0, 3}, {0, 3}, {0, -5}, {2, 0}, {-7, 0}, {1, 4}, {1, 4}, {0, 0}, {0, 2} };
+
+  encoder.enableStats(true);
+
+  constexpr auto scrollBlockId = lpvc::variant_type_index<lpvc::ScrollBlock, lpvc::FrameBlock>();
+  constexpr auto rawBitmapBlockId = lpvc::variant_type_index<lpvc::RawBitmapBlock, lpvc::FrameBlock>();
+
+  for(std::size_t frameIdx = 0; frameIdx != std::size(scrolls); ++frameIdx)
+  {
+    fillScrolledBitmap(scrolls[frameIdx].first, scrolls[frameIdx].second);
+
+    // Last frame changes besides scrolling, it's worth scrolling only if
+    // the rest of the frame is coded as changes.
+    if(frameIdx + 1 == std::size(scrolls))
+      inputBitmap[bitmapInfo.width * 15 + 20] = makeColor(255, 255, 255);
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), false);
+    auto decodeResult = decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.data());
+
+    REQUIRE(decodeResult.nullFrame == (frameIdx != 0 && scrolls[frameIdx] == scrolls[frameIdx - 1]));
+    REQUIRE(inputBitmap == outputBitmap);
+  }
+
+  // Frames with a scroll found (1, 3, 4 and 6) are coded by ScrollBlock
+  // alone, the rest need a bitmap block.
+  const auto& totalStats = encoder.totalStats();
+
+  REQUIRE(totalStats.blockCounts[scrollBlockId] == (useDirtyTiles ? 5 : 4));
+  REQUIRE(totalStats.blockCounts[rawBitmapBlockId] == 4);
+}
+
+
+TEST_CASE("Decoding in place matches decoding through iterator", "")
+{
+  auto encoderSettings = GENERATE(
+    lpvc::EncoderSettings { true, 1, 1 },
+    lpvc::EncoderSettings { false, 1, 1 },
+    makeScrollSettings(8, true, &lpvc::EncoderSettings::useResidual),
+    makeScrollSettings(8, true, &lpvc::EncoderSettings::useDirtyTiles)
+  );
+
+  auto bitmapCount = GENERATE(1, 3);
+
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto inPlaceDecoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto inPlaceBitmaps = std::vector<std::vector<lpvc::Color>>(bitmapCount, std::vector<lpvc::Color>(bitmapPixelCount));
+
+  for(std::size_t frameIdx = 0; frameIdx != 40; ++frameIdx)
+  {
+    // Pattern scrolling back and forth with occasional repeated and sparsely
+    // changed frames.
+    auto scrollIdx = ((frameIdx % 5 == 4) ? frameIdx - 1 : frameIdx) % 8;
+    auto scroll = (scrollIdx < 4) ? scrollIdx : 8 - scrollIdx;
+
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+    {
+      auto row = pixelIdx / bitmapInfo.width + scroll * 2;
+      auto column = pixelIdx % bitmapInfo.width;
+      inputBitmap[pixelIdx] = makeColor((row * 13 + column * 7) % 11 * 20, row % 3 * 80, column % 4 * 60);
+    }
+
+    if(frameIdx % 7 == 6)
+      inputBitmap[frameIdx * 17] = makeColor(255, 255, 255);
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), frameIdx % 16 == 15);
+    auto& inPlaceBitmap = inPlaceBitmaps[frameIdx % inPlaceBitmaps.size()];
+    auto decodeResult = decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+    auto inPlaceDecodeResult = inPlaceDecoder.decodeInPlace(encoderBuffer.data(), encodeResult.bytesWritten, inPlaceBitmap.data());
+
+    REQUIRE(decodeResult.keyFrame == inPlaceDecodeResult.keyFrame);
+    REQUIRE(decodeResult.nullFrame == inPlaceDecodeResult.nullFrame);
+    REQUIRE(inputBitmap == outputBitmap);
+    REQUIRE(inputBitmap == inPlaceBitmap);
+  }
+}
+
+
+TEST_CASE("Nearly static indexed frames are coded as residuals", "")
+{
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  encoderSettings.useResidual = true;
+
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+
+  encoder.enableStats(true);
+
+  constexpr auto indexedBitmapBlockId = lpvc::variant_type_index<lpvc::IndexedBitmapBlock, lpvc::FrameBlock>();
+  constexpr auto indexedResidualBitmapBlockId = lpvc::variant_type_index<lpvc::IndexedResidualBitmapBlock, lpvc::FrameBlock>();
+
+  for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+    inputBitmap[pixelIdx] = makeColor(0, 0, 100 + pixelIdx % 50);
+
+  for(std::size_t frameIdx = 0; frameIdx != 10; ++frameIdx)
+  {
+    // Single pixel changes to a color ordered before all others, which
+    // renumbers indices of the whole indexed bitmap but leaves residual zero
+    // elsewhere. Last frame moves all colors.
+    if(frameIdx + 1 == 10)
+      std::reverse(inputBitmap.begin(), inputBitmap.end());
+    else if(frameIdx != 0)
+      inputBitmap[frameIdx * 97] = makeColor(0, 0, 100 - frameIdx);
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), false);
+    decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+
+    REQUIRE(inputBitmap == outputBitmap);
+  }
+
+  const auto& totalStats = encoder.totalStats();
+
+  REQUIRE(totalStats.blockCounts[indexedResidualBitmapBlockId] == 8);
+  REQUIRE(totalStats.blockCounts[indexedBitmapBlockId] == 2);
+}
+
+
+TEST_CASE("Sparsely changed frames are coded as dirty tiles", "")
+{
+  auto usePalette = GENERATE(true, false);
+  auto bitmapCount = GENERATE(1, 3);
+
+  auto bitmapInfo = lpvc::BitmapInfo{43, 30};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto encoderSettings = lpvc::EncoderSettings { usePalette, 1, 1 };
+  encoderSettings.useDirtyTiles = true;
+
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto inPlaceDecoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto inPlaceBitmaps = std::vector<std::vector<lpvc::Color>>(bitmapCount, std::vector<lpvc::Color>(bitmapPixelCount));
+
+  encoder.enableStats(true);
+
+  constexpr auto dirtyTilesBlockId = lpvc::variant_type_index<lpvc::DirtyTilesBlock, lpvc::FrameBlock>();
+
+  fillBitmap(inputBitmap, 200);
+
+  for(std::size_t frameIdx = 0; frameIdx != 10; ++frameIdx)
+  {
+    // Single pixel changes, in the partial tiles at the edges too.
+    if(frameIdx != 0)
+      inputBitmap[(frameIdx * 149) % bitmapPixelCount] = makeColor(255, frameIdx, 0);
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), false);
+    auto& inPlaceBitmap = inPlaceBitmaps[frameIdx % inPlaceBitmaps.size()];
+
+    decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+    inPlaceDecoder.decodeInPlace(encoderBuffer.data(), encodeResult.bytesWritten, inPlaceBitmap.data());
+
+    REQUIRE(inputBitmap == outputBitmap);
+    REQUIRE(inputBitmap == inPlaceBitmap);
+  }
+
+  REQUIRE(encoder.totalStats().blockCounts[dirtyTilesBlockId] == 9);
+}
+
+
+TEST_CASE("Bitmaps in other pixel formats are converted", "")
+{
+  auto pixelFormat = GENERATE(
+    lpvc::PixelFormat::RGB24,
+    lpvc::PixelFormat::BGR24,
+    lpvc::PixelFormat::RGBX32,
+    lpvc::PixelFormat::BGRX32,
+    lpvc::PixelFormat::RGB565,
+    lpvc::PixelFormat::RGBA32,
+    lpvc::PixelFormat::BGRA32
+  );
+
+  auto bottomUp = GENERATE(false, true);
+  auto usePalette = GENERATE(true, false);
+
+  auto bitmapInfo = lpvc::BitmapInfo{21, 13};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto pixelSize = lpvc::pixelSize(pixelFormat);
+  auto pitch = bitmapInfo.width * pixelSize + 5; // Padded rows
+  auto encoder = lpvc::Encoder(bitmapInfo, lpvc::EncoderSettings { usePalette, 1, 1 });
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto formattedBitmap = std::vector<std::byte>(pitch * bitmapInfo.height);
+  auto expectedBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+
+  for(std::size_t frameIdx = 0; frameIdx != 3; ++frameIdx)
+  {
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+    {
+      // Bottom-up rows are stored in reverse order.
+      auto x = pixelIdx % bitmapInfo.width;
+      auto y = pixelIdx / bitmapInfo.width;
+      auto row = bottomUp ? bitmapInfo.height - 1 - y : y;
+      auto pixel = formattedBitmap.data() + row * pitch + x * pixelSize;
+      auto value = static_cast<unsigned int>(pixelIdx * 2654435761u + frameIdx * 97) >> 8;
+      auto r = static_cast<std::byte>(value);
+      auto g = static_cast<std::byte>(value >> 8);
+      auto b = static_cast<std::byte>(value >> 16);
+
+      switch(pixelFormat)
+      {
+        case lpvc::PixelFormat::RGB24:
+        case lpvc::PixelFormat::RGBX32:
+        case lpvc::PixelFormat::RGBA32:
+          pixel[0] = r;
+          pixel[1] = g;
+          pixel[2] = b;
+          expectedBitmap[pixelIdx] = { r, g, b };
+          break;
+
+        case lpvc::PixelFormat::BGR24:
+        case lpvc::PixelFormat::BGRX32:
+        case lpvc::PixelFormat::BGRA32:
+          pixel[0] = b;
+          pixel[1] = g;
+          pixel[2] = r;
+          expectedBitmap[pixelIdx] = { r, g, b };
+          break;
+
+        case lpvc::PixelFormat::RGB565:
+        {
+          auto r5 = (value >> 11) & 0x1F;
+          auto g6 = (value >> 5) & 0x3F;
+          auto b5 = value & 0x1F;
+
+          pixel[0] = static_cast<std::byte>(value);
+          pixel[1] = static_cast<std::byte>(value >> 8);
+          expectedBitmap[pixelIdx] = makeColor((r5 << 3) | (r5 >> 2), (g6 << 2) | (g6 >> 4), (b5 << 3) | (b5 >> 2));
+          break;
+        }
+      }
+
+      if(pixelSize == 4)
+        pixel[3] = static_cast<std::byte>(0xAA);
+    }
+
+    auto bitmap = bottomUp ? formattedBitmap.data() + (bitmapInfo.height - 1) * pitch : formattedBitmap.data();
+    auto encodeResult = encoder.encode(bitmap, bottomUp ? -static_cast<std::ptrdiff_t>(pitch) : pitch, pixelFormat, encoderBuffer.data(), false);
+    decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+
+    REQUIRE(outputBitmap == expectedBitmap);
+  }
+}
+
+
+// Settings without palette, so that frames are coded raw unless the option
+// enabled by given member handles them.
+static lpvc::EncoderSettings makeRawSettings(bool lpvc::EncoderSettings::* option)
+{
+  return makeSettings(false, option);
+}
+
+
+TEST_CASE("Frames are decoded into other pixel formats", "")
+{
+  auto encoderSettings = GENERATE(
+    lpvc::EncoderSettings { true, 1, 1 },
+    lpvc::EncoderSettings { false, 1, 1 },
+    makeScrollSettings(8, true, &lpvc::EncoderSettings::useResidual),
+    makeScrollSettings(8, true, &lpvc::EncoderSettings::useDirtyTiles),
+    makeRawSettings(&lpvc::EncoderSettings::useWidePalette),
+    makeRawSettings(&lpvc::EncoderSettings::useRawFilters),
+    makeRawSettings(&lpvc::EncoderSettings::usePlanarRaw)
+  );
+
+  auto pixelFormat = GENERATE(
+    lpvc::PixelFormat::RGB24,
+    lpvc::PixelFormat::BGR24,
+    lpvc::PixelFormat::RGBX32,
+    lpvc::PixelFormat::BGRX32,
+    lpvc::PixelFormat::RGB565,
+    lpvc::PixelFormat::RGBA32,
+    lpvc::PixelFormat::BGRA32
+  );
+
+  auto bottomUp = GENERATE(false, true);
+
+  auto bitmapInfo = lpvc::BitmapInfo{37, 30};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto pixelSize = lpvc::pixelSize(pixelFormat);
+  auto pitch = bitmapInfo.width * pixelSize + 3; // Padded rows
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto formattedDecoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto expectedBitmap = std::vector<std::byte>(pitch * bitmapInfo.height, std::byte{0x55});
+  auto formattedBitmap = std::vector<std::byte>(pitch * bitmapInfo.height, std::byte{0x55});
+
+  for(std::size_t frameIdx = 0; frameIdx != 30; ++frameIdx)
+  {
+    // Scrolling pattern with repeated, sparsely changed and solid frames.
+    auto scroll = (frameIdx % 5 == 4) ? frameIdx - 1 : frameIdx;
+
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+    {
+      auto row = pixelIdx / bitmapInfo.width + scroll % 4 * 2;
+      auto column = pixelIdx % bitmapInfo.width;
+      inputBitmap[pixelIdx] = makeColor((row * 13 + column * 7) % 11 * 20 + 3, row % 3 * 80 + 5, column % 4 * 60 + 7);
+    }
+
+    if(frameIdx % 7 == 6)
+      inputBitmap[frameIdx * 17] = makeColor(255, 255, 255);
+
+    if(frameIdx % 11 == 10)
+      std::fill(inputBitmap.begin(), inputBitmap.end(), makeColor(200, 100, 50));
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), false);
+    auto decodeResult = decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+
+    auto bitmap = bottomUp ? formattedBitmap.data() + (bitmapInfo.height - 1) * pitch : formattedBitmap.data();
+    auto formattedDecodeResult = formattedDecoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, bitmap,
+                                                         bottomUp ? -static_cast<std::ptrdiff_t>(pitch) : pitch, pixelFormat);
+
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+    {
+      auto x = pixelIdx % bitmapInfo.width;
+      auto y = pixelIdx / bitmapInfo.width;
+      auto row = bottomUp ? bitmapInfo.height - 1 - y : y;
+      auto pixel = expectedBitmap.data() + row * pitch + x * pixelSize;
+      auto [r, g, b] = outputBitmap[pixelIdx];
+
+      switch(pixelFormat)
+      {
+        case lpvc::PixelFormat::RGB24:
+        case lpvc::PixelFormat::RGBX32:
+        case lpvc::PixelFormat::RGBA32:
+          pixel[0] = r;
+          pixel[1] = g;
+          pixel[2] = b;
+          break;
+
+        case lpvc::PixelFormat::BGR24:
+        case lpvc::PixelFormat::BGRX32:
+        case lpvc::PixelFormat::BGRA32:
+          pixel[0] = b;
+          pixel[1] = g;
+          pixel[2] = r;
+          break;
+
+        case lpvc::PixelFormat::RGB565:
+        {
+          auto value = ((std::to_integer<unsigned int>(r) >> 3) << 11) |
+                       ((std::to_integer<unsigned int>(g) >> 2) << 5) |
+                       (std::to_integer<unsigned int>(b) >> 3);
+
+          pixel[0] = static_cast<std::byte>(value);
+          pixel[1] = static_cast<std::byte>(value >> 8);
+          break;
+        }
+      }
+
+      if(pixelSize == 4)
+        pixel[3] = static_cast<std::byte>(0xFF);
+    }
+
+    REQUIRE(decodeResult.keyFrame == formattedDecodeResult.keyFrame);
+    REQUIRE(decodeResult.nullFrame == formattedDecodeResult.nullFrame);
+    REQUIRE(inputBitmap == outputBitmap);
+    REQUIRE(formattedBitmap == expectedBitmap);
+  }
+}
+
+
+TEST_CASE("Encoder and decoder statistics agree", "")
+{
+  auto encoderSettings = GENERATE(
+    lpvc::EncoderSettings { true, 1, 1 },
+    lpvc::EncoderSettings { false, 1, 1 },
+    makeScrollSettings(8, true, &lpvc::EncoderSettings::useResidual, &lpvc::EncoderSettings::useDirtyTiles)
+  );
+
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  std::size_t totalSize = 0;
+
+  for(std::size_t frameIdx = 0; frameIdx != 20; ++frameIdx)
+  {
+    // Statistics are not collected for the first frames.
+    encoder.enableStats(frameIdx >= 4);
+    decoder.enableStats(frameIdx >= 4);
+
+    fillBitmap(inputBitmap, 1 + frameIdx % 6 * 50);
+    std::rotate(inputBitmap.begin(), inputBitmap.begin() + frameIdx % 3, inputBitmap.end());
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), frameIdx % 8 == 0);
+    decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+
+    if(frameIdx < 4)
+    {
+      REQUIRE(encoder.frameStats().frameCount == 0);
+      REQUIRE(decoder.frameStats().frameCount == 0);
+      continue;
+    }
+
+    const auto& encoderStats = encoder.frameStats();
+    const auto& decoderStats = decoder.frameStats();
+    std::size_t blocksSize = 0;
+
+    for(auto blockSize : encoderStats.blockSizes)
+      blocksSize += blockSize;
+
+    REQUIRE(encoderStats.frameCount == 1);
+    REQUIRE(encoderStats.keyFrameCount == encodeResult.keyFrame);
+    REQUIRE(encoderStats.size == encodeResult.bytesWritten);
+    REQUIRE(blocksSize == encodeResult.bytesWritten);
+    REQUIRE(encoderStats.blockCounts == decoderStats.blockCounts);
+    REQUIRE(encoderStats.blockSizes == decoderStats.blockSizes);
+    REQUIRE(encoderStats.paletteSize == decoderStats.paletteSize);
+    REQUIRE(encoderStats.paletteBits == decoderStats.paletteBits);
+    REQUIRE(decoderStats.analysisTime == 0);
+
+    totalSize += encodeResult.bytesWritten;
+  }
+
+  REQUIRE(encoder.totalStats().frameCount == 16);
+  REQUIRE(encoder.totalStats().keyFrameCount == 2);
+  REQUIRE(encoder.totalStats().size == totalSize);
+  REQUIRE(decoder.totalStats().size == totalSize);
+  REQUIRE(encoder.totalStats().blockCounts == decoder.totalStats().blockCounts);
+
+  encoder.resetStats();
+
+  REQUIRE(encoder.totalStats().frameCount == 0);
+}
+
+
+TEST_CASE("Compression level adapts to frame time budget", "")
+{
+  auto frameTimeBudget = GENERATE(1, 1000000);
+
+  auto bitmapInfo = lpvc::BitmapInfo{64, 64};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto encoderSettings = lpvc::EncoderSettings { true, 6, 1 };
+  encoderSettings.frameTimeBudget = frameTimeBudget;
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+
+  REQUIRE(encoder.compressionLevel() == 1);
+
+  for(std::size_t frameIdx = 0; frameIdx != 20; ++frameIdx)
+  {
+    fillBitmap(inputBitmap, 1 + frameIdx * 97 % 300);
+    std::rotate(inputBitmap.begin(), inputBitmap.begin() + frameIdx, inputBitmap.end());
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), false);
+    decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+
+    REQUIRE(inputBitmap == outputBitmap);
+  }
+
+  // Level never goes beyond zstdCompressionLevel. Budget of 1 us can't be
+  // met at any level.
+  REQUIRE(encoder.compressionLevel() == (frameTimeBudget == 1 ? 1 : 6));
+
+
+  // New level wouldn't take effect before the next key frame without zstd
+  // workers.
+  encoderSettings.zstdWorkerCount = 0;
+
+  REQUIRE_THROWS_AS(lpvc::Encoder(bitmapInfo, encoderSettings), std::invalid_argument);
+}
+
+
+TEST_CASE("Key frames are placed automatically", "")
+{
+  auto bitmapInfo = lpvc::BitmapInfo{32, 32};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  encoderSettings.minKeyFrameInterval = 4;
+  encoderSettings.maxKeyFrameInterval = 10;
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto keyFrames = std::vector<std::size_t>();
+
+  for(std::size_t frameIdx = 0; frameIdx != 32; ++frameIdx)
+  {
+    // Scenes differ in colors and change at frames 2, 8 and 14, after which
+    // nothing changes. Scene change at frame 2 comes too early, caller asks
+    // for key frame 20, maximum interval places key frame 30.
+    auto scene = (frameIdx < 2) ? 0 : (frameIdx < 8) ? 1 : (frameIdx < 14) ? 2 : 3;
+
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+      inputBitmap[pixelIdx] = makeColor(scene * 60 + pixelIdx % 7, (pixelIdx + (frameIdx < 14 ? frameIdx : 0)) % 5 * 40, scene * 50);
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), frameIdx == 20);
+    auto decodeResult = decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+
+    REQUIRE(decodeResult.keyFrame == encodeResult.keyFrame);
+    REQUIRE(inputBitmap == outputBitmap);
+
+    if(encodeResult.keyFrame)
+      keyFrames.push_back(frameIdx);
+  }
+
+  REQUIRE(keyFrames == std::vector<std::size_t>{ 0, 8, 14, 20, 30 });
+}
+
+
+TEST_CASE("Palettes of recurring scenes are recalled", "")
+{
+  auto usePaletteCache = GENERATE(false, true);
+
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  auto encoderBuffer = std::vector<std::byte>();
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+
+  encoderSettings.usePaletteCache = usePaletteCache;
+
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto keyFrameDecoder = lpvc::Decoder(bitmapInfo);
+
+  encoderBuffer.resize(encoder.safeOutputBufferSize());
+  encoder.enableStats(true);
+
+  constexpr auto paletteBlockId = lpvc::variant_type_index<lpvc::PaletteBlock, lpvc::FrameBlock>();
+  constexpr auto paletteRecallBlockId = lpvc::variant_type_index<lpvc::PaletteRecallBlock, lpvc::FrameBlock>();
+
+  for(std::size_t frameIdx = 0; frameIdx != 24; ++frameIdx)
+  {
+    // Two scenes with 12 distinct colors each take turns every 3 frames, the
+    // second one gains another color later on. Both never fit in a single
+    // 4-bit palette.
+    auto scene = frameIdx / 3 % 2;
+    auto colorCount = (scene == 1 && frameIdx >= 12) ? 13 : 12;
+
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+    {
+      auto colorIdx = (pixelIdx / 7 + frameIdx) % colorCount;
+      inputBitmap[pixelIdx] = makeColor(scene * 128 + colorIdx * 10, colorIdx * 20, 100);
+    }
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), frameIdx == 18);
+    decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+
+    REQUIRE(inputBitmap == outputBitmap);
+
+    // Key frame clears the cache, so decoding may start at it.
+    if(frameIdx >= 18)
+    {
+      keyFrameDecoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+      REQUIRE(inputBitmap == outputBitmap);
+    }
+  }
+
+  const auto& totalStats = encoder.totalStats();
+
+  if(usePaletteCache)
+  {
+    // Palettes are sent on the first appearance of each scene (frames 0 and
+    // 3) and again after the key frame (frames 18 and 21). Scenes returning
+    // in frames 6, 9, 12 and 15 are recalled, frame 15 then adds the color
+    // gained by the second scene in a palette block of its own.
+    REQUIRE(totalStats.blockCounts[paletteRecallBlockId] == 4);
+    REQUIRE(totalStats.blockCounts[paletteBlockId] == 5);
+  }
+  else
+  {
+    REQUIRE(totalStats.blockCounts[paletteRecallBlockId] == 0);
+    REQUIRE(totalStats.blockCounts[paletteBlockId] == 8);
+  }
+}
+
+
+TEST_CASE("Frames with ordered palette are decoded correctly", "")
+{
+  auto useResidual = GENERATE(false, true);
+
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  encoderSettings.useResidual = useResidual;
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+
+  encoderSettings.useOrderedPalette = true;
+
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+
+  encoder.enableStats(true);
+
+  constexpr auto paletteBlockId = lpvc::variant_type_index<lpvc::PaletteBlock, lpvc::FrameBlock>();
+  constexpr auto paletteOrderBlockId = lpvc::variant_type_index<lpvc::PaletteOrderBlock, lpvc::FrameBlock>();
+
+  for(std::size_t frameIdx = 0; frameIdx != 30; ++frameIdx)
+  {
+    // Every other frame a color sorting before all others shows up, so merged
+    // palettes would shift all indices. Palette is reset whenever indices
+    // need more bits.
+    auto colorCount = 3 + frameIdx / 2;
+
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+    {
+      auto colorIdx = std::min<std::size_t>(pixelIdx % 23, colorCount - 1);
+      inputBitmap[pixelIdx] = makeColor(200 - colorIdx * 10, colorIdx, 50);
+    }
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), false);
+    decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+
+    REQUIRE(inputBitmap == outputBitmap);
+  }
+
+  const auto& totalStats = encoder.totalStats();
+
+  REQUIRE(totalStats.blockCounts[paletteBlockId] == 0);
+  REQUIRE(totalStats.blockCounts[paletteOrderBlockId] == 15);
+}
+
+
+TEST_CASE("Frames with more than 256 colors use wide palette", "")
+{
+  auto bitmapInfo = lpvc::BitmapInfo{80, 60};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+
+  encoderSettings.useWidePalette = true;
+
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+
+  encoder.enableStats(true);
+
+  constexpr auto indexedBitmapBlockId = lpvc::variant_type_index<lpvc::IndexedBitmapBlock, lpvc::FrameBlock>();
+  constexpr auto rawBitmapBlockId = lpvc::variant_type_index<lpvc::RawBitmapBlock, lpvc::FrameBlock>();
+  constexpr auto widePaletteBlockId = lpvc::variant_type_index<lpvc::WidePaletteBlock, lpvc::FrameBlock>();
+  constexpr auto wideIndexedBitmapBlockId = lpvc::variant_type_index<lpvc::WideIndexedBitmapBlock, lpvc::FrameBlock>();
+
+  for(std::size_t frameIdx = 0; frameIdx != 12; ++frameIdx)
+  {
+    // Frames take 1500 colors each, 300 of them new. Wide palette runs out
+    // of room at frame 9 and gets reset. Frame 5 has a distinct color in
+    // every pixel, too many for wide palette, frame 6 fits a regular one.
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+    {
+      std::size_t colorIdx = pixelIdx % 1500 + frameIdx * 300;
+
+      if(frameIdx == 5)
+        colorIdx = pixelIdx + 10000;
+      else if(frameIdx == 6)
+        colorIdx = pixelIdx % 200;
+
+      inputBitmap[pixelIdx] = makeColor(colorIdx & 0xFF, colorIdx >> 8, 7);
+    }
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), false);
+    decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+
+    REQUIRE(inputBitmap == outputBitmap);
+  }
+
+  const auto& totalStats = encoder.totalStats();
+
+  REQUIRE(totalStats.blockCounts[wideIndexedBitmapBlockId] == 10);
+  REQUIRE(totalStats.blockCounts[widePaletteBlockId] == 10);
+  REQUIRE(totalStats.blockCounts[rawBitmapBlockId] == 1);
+  REQUIRE(totalStats.blockCounts[indexedBitmapBlockId] == 1);
+}
+
+
+TEST_CASE("Raw frames with filters are decoded correctly", "")
+{
+  auto bitmapInfo = lpvc::BitmapInfo{80, 60};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto inPlaceBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+
+  encoderSettings.useRawFilters = true;
+
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto inPlaceDecoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+
+  encoder.enableStats(true);
+
+  constexpr auto rawBitmapBlockId = lpvc::variant_type_index<lpvc::RawBitmapBlock, lpvc::FrameBlock>();
+  constexpr auto filteredRawBitmapBlockId = lpvc::variant_type_index<lpvc::FilteredRawBitmapBlock, lpvc::FrameBlock>();
+
+  for(std::size_t frameIdx = 0; frameIdx != 10; ++frameIdx)
+  {
+    // Gradients with dithering moving across the frame leave too many colors
+    // for a palette.
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+    {
+      auto x = pixelIdx % bitmapInfo.width;
+      auto y = pixelIdx / bitmapInfo.width;
+      auto dither = (x + y + frameIdx) % 3;
+      inputBitmap[pixelIdx] = makeColor(x * 3 + dither, y * 4 + frameIdx, (x * y + dither * 40) % 256);
+    }
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), frameIdx == 5);
+    decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+
+    REQUIRE(inputBitmap == outputBitmap);
+
+    // Previous frame filter reads the frame being overwritten.
+    inPlaceDecoder.decodeInPlace(encoderBuffer.data(), encodeResult.bytesWritten, inPlaceBitmap.data());
+
+    REQUIRE(inputBitmap == inPlaceBitmap);
+  }
+
+  const auto& totalStats = encoder.totalStats();
+
+  REQUIRE(totalStats.blockCounts[rawBitmapBlockId] == 0);
+  REQUIRE(totalStats.blockCounts[filteredRawBitmapBlockId] == 10);
+}
+
+
+TEST_CASE("Raw frames without runs of colors are coded as planes", "")
+{
+  auto bitmapInfo = lpvc::BitmapInfo{83, 60};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+
+  encoderSettings.usePlanarRaw = true;
+
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+
+  encoder.enableStats(true);
+
+  constexpr auto rawBitmapBlockId = lpvc::variant_type_index<lpvc::RawBitmapBlock, lpvc::FrameBlock>();
+  constexpr auto planarRawBitmapBlockId = lpvc::variant_type_index<lpvc::PlanarRawBitmapBlock, lpvc::FrameBlock>();
+
+  for(std::size_t frameIdx = 0; frameIdx != 10; ++frameIdx)
+  {
+    // Even frames are gradients, odd ones runs of 8 pixels of the same color.
+    // Both have too many colors for a palette.
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+    {
+      auto x = pixelIdx % bitmapInfo.width;
+      auto y = pixelIdx / bitmapInfo.width;
+
+      if(frameIdx % 2 == 0)
+        inputBitmap[pixelIdx] = makeColor(x * 3, y * 4 + frameIdx, x + y);
+      else
+        inputBitmap[pixelIdx] = makeColor(pixelIdx / 8 % 256, pixelIdx / 2048, frameIdx);
+    }
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), false);
+    decoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, outputBitmap.begin());
+
+    REQUIRE(inputBitmap == outputBitmap);
+  }
+
+  const auto& totalStats = encoder.totalStats();
+
+  REQUIRE(totalStats.blockCounts[rawBitmapBlockId] == 5);
+  REQUIRE(totalStats.blockCounts[planarRawBitmapBlockId] == 5);
+}
+
+
+TEST_CASE("Color planes are split and merged", "")
+{
+  // Vector loops take 16 or 32 pixels at a time, remaining ones are handled
+  // one by one.
+  for(std::size_t count = 0; count != 100; ++count)
+  {
+    auto colors = std::vector<std::byte>(count * 3);
+    auto planes = std::vector<std::vector<std::byte>>(3, std::vector<std::byte>(count));
+    auto mergedColors = std::vector<std::byte>(count * 3);
+
+    for(std::size_t idx = 0; idx != colors.size(); ++idx)
+      colors[idx] = static_cast<std::byte>(idx * 7 + idx / 3);
+
+    lpvc::splitColorPlanes(colors.data(), count, planes[0].data(), planes[1].data(), planes[2].data());
+
+    for(std::size_t idx = 0; idx != count; ++idx)
+    {
+      REQUIRE(planes[0][idx] == colors[idx * 3 + 0]);
+      REQUIRE(planes[1][idx] == colors[idx * 3 + 1]);
+      REQUIRE(planes[2][idx] == colors[idx * 3 + 2]);
+    }
+
+    lpvc::mergeColorPlanes(planes[0].data(), planes[1].data(), planes[2].data(), count, mergedColors.data());
+
+    REQUIRE(mergedColors == colors);
+  }
+}
+
+
+TEST_CASE("Streams encoded with trained dictionary", "")
+{
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto bitmapPixelCount = bitmapInfo.width * bitmapInfo.height;
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapPixelCount);
+
+  auto fillFrame = [&](std::size_t frameIdx)
+  {
+    for(std::size_t pixelIdx = 0; pixelIdx != bitmapPixelCount; ++pixelIdx)
+    {
+      auto row = pixelIdx / bitmapInfo.width;
+      auto column = pixelIdx % bitmapInfo.width + frameIdx;
+      inputBitmap[pixelIdx] = makeColor((row * column) % 13 * 19, column % 7 * 30, (row + frameIdx) % 5 * 50);
+    }
+  };
+
+  auto encodeStream = [&](const lpvc::EncoderSettings& encoderSettings, std::size_t frameCount, auto&& frameFunction)
+  {
+    auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+    auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+
+    for(std::size_t frameIdx = 0; frameIdx != frameCount; ++frameIdx)
+    {
+      fillFrame(frameIdx);
+
+      auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), frameIdx % 4 == 0);
+      frameFunction(encoderBuffer.data(), encodeResult.bytesWritten);
+    }
+  };
+
+  auto trainer = lpvc::DictionaryTrainer(bitmapInfo);
+
+  for(auto usePalette : { true, false })
+  {
+    encodeStream(lpvc::EncoderSettings { usePalette, 1, 1 }, 64,
+      [&](const std::byte* frame, std::size_t frameSize) { trainer.addFrame(frame, frameSize); });
+  }
+
+  auto dictionary = std::make_shared<const lpvc::Dictionary>(trainer.train(4096));
+
+  REQUIRE(dictionary->size() != 0);
+  REQUIRE(dictionary->size() <= 4096);
+
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  encoderSettings.dictionary = dictionary;
+  encoderSettings.frameTimeBudget = GENERATE(0, 1000000);
+
+  SECTION("Decoder with the same dictionary")
+  {
+    auto decoder = lpvc::Decoder(bitmapInfo, dictionary);
+
+    encodeStream(encoderSettings, 16,
+      [&](const std::byte* frame, std::size_t frameSize)
+      {
+        decoder.decode(frame, frameSize, outputBitmap.begin());
+        REQUIRE(inputBitmap == outputBitmap);
+      }
+    );
+  }
+
+  SECTION("Decoder without dictionary")
+  {
+    auto decoder = lpvc::Decoder(bitmapInfo);
+
+    encodeStream(encoderSettings, 1,
+      [&](const std::byte* frame, std::size_t frameSize)
+      {
+        REQUIRE_THROWS_AS(decoder.decode(frame, frameSize, outputBitmap.begin()), std::runtime_error);
+      }
+    );
+  }
+}
+
+
+TEST_CASE("Parallel encoder output matches sequential encoder", "")
+{
+  auto threadCount = GENERATE(1, 4);
+  auto segmentLength = GENERATE(1, 5, 64);
+
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapInfo.width * bitmapInfo.height);
+  auto expectedFrames = std::vector<std::pair<std::vector<std::byte>, bool>>();
+  auto frames = std::vector<std::pair<std::vector<std::byte>, bool>>();
+
+  auto parallelEncoder = lpvc::ParallelEncoder(bitmapInfo, encoderSettings,
+    [&](const std::byte* frame, std::size_t frameSize, bool keyFrame)
+    {
+      frames.emplace_back(std::vector<std::byte>(frame, frame + frameSize), keyFrame);
+    },
+    threadCount, segmentLength
+  );
+
+  std::size_t segmentFrameCount = 0;
+
+  for(std::size_t frameIdx = 0; frameIdx != 50; ++frameIdx)
+  {
+    fillBitmap(inputBitmap, frameIdx % 20 + 1);
+    inputBitmap[frameIdx] = makeColor(255, 0, 255);
+
+    auto keyFrame = (frameIdx % 13 == 12);
+
+    parallelEncoder.encode(inputBitmap.begin(), keyFrame);
+
+    // Segments start on requested key frames and when the previous one is full.
+    if(keyFrame || segmentFrameCount == static_cast<std::size_t>(segmentLength))
+      segmentFrameCount = 0;
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), segmentFrameCount++ == 0);
+    expectedFrames.emplace_back(std::vector<std::byte>(encoderBuffer.begin(), encoderBuffer.begin() + encodeResult.bytesWritten), encodeResult.keyFrame);
+  }
+
+  parallelEncoder.flush();
+
+  REQUIRE(frames == expectedFrames);
+}
+
+
+TEST_CASE("Parallel decoder delivers frames in order", "")
+{
+  auto threadCount = GENERATE(1, 4);
+  auto keyFrameInterval = GENERATE(1, 7, 30);
+
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  encoderSettings.useDirtyTiles = true;
+
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmaps = std::vector<std::vector<lpvc::Color>>();
+  auto keyFrames = std::vector<bool>();
+  std::size_t frameIdx = 0;
+
+  auto parallelDecoder = lpvc::ParallelDecoder(bitmapInfo,
+    [&](const lpvc::Color* bitmap, const lpvc::Decoder::DecodeResult& decodeResult)
+    {
+      REQUIRE(frameIdx < inputBitmaps.size());
+      REQUIRE(decodeResult.keyFrame == keyFrames[frameIdx]);
+      REQUIRE(std::equal(inputBitmaps[frameIdx].begin(), inputBitmaps[frameIdx].end(), bitmap));
+      ++frameIdx;
+    },
+    threadCount
+  );
+
+  for(std::size_t inputFrameIdx = 0; inputFrameIdx != 60; ++inputFrameIdx)
+  {
+    auto& inputBitmap = inputBitmaps.emplace_back(bitmapInfo.width * bitmapInfo.height);
+
+    fillBitmap(inputBitmap, inputFrameIdx % 9 + 1);
+    inputBitmap[inputFrameIdx * 5] = makeColor(0, 255, 0);
+
+    // Repeated frames are coded as null frames.
+    if(inputFrameIdx % 10 == 9)
+      inputBitmap = inputBitmaps[inputFrameIdx - 1];
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), inputFrameIdx % keyFrameInterval == 0);
+    keyFrames.push_back(encodeResult.keyFrame);
+
+    parallelDecoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, encodeResult.keyFrame);
+  }
+
+  parallelDecoder.flush();
+
+  REQUIRE(frameIdx == inputBitmaps.size());
+}
+
+
+TEST_CASE("Parallel decoder rejects segments without key frame", "")
+{
+  auto bitmapInfo = lpvc::BitmapInfo{17, 17};
+  auto encoder = lpvc::Encoder(bitmapInfo, lpvc::EncoderSettings { true, 1, 1 });
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapInfo.width * bitmapInfo.height);
+  auto parallelDecoder = lpvc::ParallelDecoder(bitmapInfo, [](const lpvc::Color*, const lpvc::Decoder::DecodeResult&) {}, 2);
+
+  for(std::size_t frameIdx = 0; frameIdx != 2; ++frameIdx)
+  {
+    fillBitmap(inputBitmap, frameIdx + 2);
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), false);
+    parallelDecoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, true);
+  }
+
+  REQUIRE_THROWS_AS(parallelDecoder.flush(), std::runtime_error);
+}
+
+
+TEST_CASE("Parallel decoder rejects segments starting with a delta frame", "")
+{
+  auto useDirtyTiles = GENERATE(false, true);
+
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  encoderSettings.useDirtyTiles = useDirtyTiles;
+
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapInfo.width * bitmapInfo.height);
+  auto parallelDecoder = lpvc::ParallelDecoder(bitmapInfo, [](const lpvc::Color*, const lpvc::Decoder::DecodeResult&) {}, 1);
+
+  encoder.enableStats(true);
+
+  constexpr auto nullBitmapBlockId = lpvc::variant_type_index<lpvc::NullBitmapBlock, lpvc::FrameBlock>();
+  constexpr auto dirtyTilesBlockId = lpvc::variant_type_index<lpvc::DirtyTilesBlock, lpvc::FrameBlock>();
+
+  // Single worker decodes both segments, second one would refer to the
+  // frame of the first one. It's either the same frame again or the same
+  // frame with a single pixel changed.
+  for(std::size_t frameIdx = 0; frameIdx != 2; ++frameIdx)
+  {
+    fillBitmap(inputBitmap, 5);
+
+    if(frameIdx == 1 && useDirtyTiles)
+      inputBitmap[0] = makeColor(255, 255, 255);
+
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), false);
+    parallelDecoder.decode(encoderBuffer.data(), encodeResult.bytesWritten, true);
+  }
+
+  const auto& frameStats = encoder.frameStats();
+
+  REQUIRE(frameStats.blockCounts[useDirtyTiles ? dirtyTilesBlockId : nullBitmapBlockId] == 1);
+  REQUIRE_THROWS_AS(parallelDecoder.flush(), std::runtime_error);
+}
+
+
+TEST_CASE("Asynchronous encoder output matches sequential encoder", "")
+{
+  auto slotCount = GENERATE(1, 3);
+  auto useResidual = GENERATE(false, true);
+
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto encoderSettings = lpvc::EncoderSettings { true, 1, 1 };
+  encoderSettings.useResidual = useResidual;
+  auto encoder = lpvc::Encoder(bitmapInfo, encoderSettings);
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmap = std::vector<lpvc::Color>(bitmapInfo.width * bitmapInfo.height);
+  auto expectedFrames = std::vector<std::pair<std::vector<std::byte>, bool>>();
+  auto frames = std::vector<std::pair<std::vector<std::byte>, bool>>();
+
+  auto asyncEncoder = lpvc::AsyncEncoder(bitmapInfo, encoderSettings,
+    [&](const std::byte* frame, const lpvc::Encoder::EncodeResult& encodeResult)
+    {
+      frames.emplace_back(std::vector<std::byte>(frame, frame + encodeResult.bytesWritten), encodeResult.keyFrame);
+    },
+    slotCount
+  );
+
+  for(std::size_t frameIdx = 0; frameIdx != 40; ++frameIdx)
+  {
+    fillBitmap(inputBitmap, frameIdx % 12 + 1);
+
+    auto keyFrame = (frameIdx % 16 == 15);
+    auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), keyFrame);
+    expectedFrames.emplace_back(std::vector<std::byte>(encoderBuffer.begin(), encoderBuffer.begin() + encodeResult.bytesWritten), encodeResult.keyFrame);
+
+    // Dropped frames are submitted again with waiting.
+    if(frameIdx % 2 == 0 || !asyncEncoder.tryEncode(inputBitmap.begin(), keyFrame))
+      asyncEncoder.encode(inputBitmap.begin(), keyFrame);
+  }
+
+  asyncEncoder.flush();
+
+  REQUIRE(frames == expectedFrames);
+}
+
+
+TEST_CASE("Asynchronous encoder restarts with a key frame after an error", "")
+{
+  auto bitmapInfo = lpvc::BitmapInfo{40, 30};
+  auto decoder = lpvc::Decoder(bitmapInfo);
+  auto inputBitmaps = std::vector<std::vector<lpvc::Color>>(30, std::vector<lpvc::Color>(bitmapInfo.width * bitmapInfo.height));
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapInfo.width * bitmapInfo.height);
+  auto keyFrameIndices = std::vector<std::size_t>();
+  auto matchingFrameIndices = std::vector<std::size_t>();
+  std::size_t frameIdx = 0;
+
+  // Frames are submitted one by one, so the callback knows which one it got.
+  auto asyncEncoder = lpvc::AsyncEncoder(bitmapInfo, lpvc::EncoderSettings(),
+    [&](const std::byte* frame, const lpvc::Encoder::EncodeResult& encodeResult)
+    {
+      if(frameIdx == 10)
+        throw std::runtime_error("Output failed.");
+
+      if(encodeResult.keyFrame)
+        keyFrameIndices.push_back(frameIdx);
+
+      decoder.decode(frame, encodeResult.bytesWritten, outputBitmap.begin());
+
+      if(outputBitmap == inputBitmaps[frameIdx])
+        matchingFrameIndices.push_back(frameIdx);
+    }
+  );
+
+  for(; frameIdx != inputBitmaps.size(); ++frameIdx)
+  {
+    fillBitmap(inputBitmaps[frameIdx], frameIdx % 12 + 1);
+    asyncEncoder.encode(inputBitmaps[frameIdx].begin(), false);
+
+    if(frameIdx == 10)
+      REQUIRE_THROWS_AS(asyncEncoder.flush(), std::runtime_error);
+    else
+      asyncEncoder.flush();
+  }
+
+  REQUIRE(keyFrameIndices == std::vector<std::size_t>{ 0, 11 });
+  REQUIRE(matchingFrameIndices.size() == inputBitmaps.size() - 1);
+}
+
+
+TEST_CASE("Container frames are decoded by seeking", "")
+{
+  auto bitmapInfo = lpvc::BitmapInfo{17, 17};
+  auto path = (std::filesystem::temp_directory_path() / "liblpvc-test-container.lpvc").string();
+  auto encoder = lpvc::Encoder(bitmapInfo, lpvc::EncoderSettings { true, 1, 1 });
+  auto encoderBuffer = std::vector<std::byte>(encoder.safeOutputBufferSize());
+  auto inputBitmaps = std::vector<std::vector<lpvc::Color>>();
+  auto outputBitmap = std::vector<lpvc::Color>(bitmapInfo.width * bitmapInfo.height);
+
+  {
+    auto containerWriter = lpvc::ContainerWriter(path, bitmapInfo);
+
+    for(std::size_t frameIdx = 0; frameIdx != 50; ++frameIdx)
+    {
+      auto& inputBitmap = inputBitmaps.emplace_back(bitmapInfo.width * bitmapInfo.height);
+      fillBitmap(inputBitmap, frameIdx % 17 + 1);
+
+      auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), frameIdx % 10 == 0);
+      containerWriter.write(encoderBuffer.data(), encodeResult.bytesWritten, encodeResult.keyFrame);
+    }
+  }
+
+  {
+    auto containerReader = lpvc::ContainerReader(path);
+    auto decoder = lpvc::Decoder(containerReader.bitmapInfo());
+
+    REQUIRE(containerReader.bitmapInfo().width == bitmapInfo.width);
+    REQUIRE(containerReader.bitmapInfo().height == bitmapInfo.height);
+    REQUIRE(containerReader.frameCount() == inputBitmaps.size());
+    REQUIRE(containerReader.frame(20).keyFrame);
+    REQUIRE(!containerReader.frame(25).keyFrame);
+    REQUIRE(containerReader.keyFrameIndex(29) == 20);
+    REQUIRE_THROWS_AS(containerReader.frame(50), std::out_of_range);
+
+    for(std::size_t frameIdx : { 0, 1, 2, 37, 12, 13, 49, 40, 5, 5, 30, 31 })
+    {
+      auto decodeResult = decoder.seek(containerReader, frameIdx, outputBitmap.begin());
+
+      REQUIRE(decodeResult.keyFrame == (frameIdx % 10 == 0));
+      REQUIRE(outputBitmap == inputBitmaps[frameIdx]);
+    }
+
+    // Plain decoding in between seeks must not be mistaken for seek position.
+    auto frame = containerReader.frame(40);
+    decoder.decode(frame.data, frame.size, outputBitmap.begin());
+    decoder.seek(containerReader, 32, outputBitmap.begin());
+
+    REQUIRE(outputBitmap == inputBitmaps[32]);
+  }
+
+  {
+    // Reader replaced by another one, likely at the same address, must not
+    // be mistaken for the one seeked last.
+    auto otherPath = (std::filesystem::temp_directory_path() / "liblpvc-test-container-other.lpvc").string();
+    auto otherInputBitmaps = std::vector<std::vector<lpvc::Color>>();
+    auto containerReader = std::optional<lpvc::ContainerReader>(std::in_place, path);
+    auto decoder = lpvc::Decoder(bitmapInfo);
+
+    {
+      auto containerWriter = lpvc::ContainerWriter(otherPath, bitmapInfo);
+
+      for(std::size_t frameIdx = 0; frameIdx != 50; ++frameIdx)
+      {
+        auto& inputBitmap = otherInputBitmaps.emplace_back(bitmapInfo.width * bitmapInfo.height);
+        fillBitmap(inputBitmap, frameIdx % 13 + 1);
+        std::reverse(inputBitmap.begin(), inputBitmap.end());
+
+        auto encodeResult = encoder.encode(inputBitmap.begin(), encoderBuffer.data(), frameIdx % 10 == 0);
+        containerWriter.write(encoderBuffer.data(), encodeResult.bytesWritten, encodeResult.keyFrame);
+      }
+    }
+
+    decoder.seek(*containerReader, 31, outputBitmap.begin());
+    containerReader.emplace(otherPath);
+    decoder.seek(*containerReader, 32, outputBitmap.begin());
+
+    REQUIRE(outputBitmap == otherInputBitmaps[32]);
+
+    containerReader.reset();
+    std::filesystem::remove(otherPath);
+  }
+
+  std::filesystem::remove(path);
+}
+
+
+TEST_CASE("Palette analysis collects colors of the bitmap", "")
+{
+  auto bitmapInfo = lpvc::BitmapInfo{64, 64};
+  lpvc::Encoder encoder(bitmapInfo);
+  std::vector<lpvc::Color> bitmap(bitmapInfo.width * bitmapInfo.height);
+
+  // Colors made by fillBitmap are already in palette order.
+  fillBitmap(bitmap, lpvc::Palette::maxColorCount);
+
+  auto palette = encoder.analyzePalette(bitmap.data());
+
+  REQUIRE(palette);
+  REQUIRE(palette->size() == lpvc::Palette::maxColorCount);
+  REQUIRE(std::equal(palette->begin(), palette->end(), bitmap.begin()));
+
+  fillBitmap(bitmap, lpvc::Palette::maxColorCount + 1);
+
+  REQUIRE(!encoder.analyzePalette(bitmap.data()));
+}